@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Report the average in-kernel cost (ns per packet) of the attached TC/XDP programs.
+# Used to compare kernel build options, e.g. the shared LRU hash vs. PERCPU=1.
+#
+# Usage: sudo bash bpf_prog_ns_per_pkt.sh [DURATION_SECONDS]
+#
+# Run traffic (iperf3/pktgen) while measuring. Example for a before/after comparison:
+#   bash compile_kernel.sh            && <attach> && sudo bash bpf_prog_ns_per_pkt.sh 30
+#   PERCPU=1 bash compile_kernel.sh   && <attach> && sudo bash bpf_prog_ns_per_pkt.sh 30
+#   VLAN=1 DECAP=1 bash compile_kernel.sh && <attach> && sudo bash bpf_prog_ns_per_pkt.sh 30
+
+DURATION=${1:-10}
+
+# Collect run_time_ns and run_cnt (only updated while bpf_stats_enabled=1)
+sudo sysctl -q -w kernel.bpf_stats_enabled=1
+
+snapshot() {
+    sudo bpftool prog show --json | python3 -c '
+import json, sys
+for p in json.load(sys.stdin):
+    if p.get("type") in ("sched_cls", "xdp"):
+        print(p["id"], p.get("name", "-"), p.get("run_time_ns", 0), p.get("run_cnt", 0))
+'
+}
+
+BEFORE=$(snapshot)
+sleep "$DURATION"
+AFTER=$(snapshot)
+
+sudo sysctl -q -w kernel.bpf_stats_enabled=0
+
+echo "id name packets ns_per_packet"
+join <(echo "$BEFORE" | sort) <(echo "$AFTER" | sort) | \
+    awk '{ cnt = $7 - $4; ns = $6 - $3; if (cnt > 0) printf "%s %s %d %.1f\n", $1, $2, cnt, ns / cnt }'
@@ -0,0 +1,165 @@
+/**
+ * Benchmark of the exporter's per-window delta computation: the batched `window_deltas()`
+ * kernel (delta_kernel.h) against the previous `get_diff_vector()`, called once per
+ * metric per IP with a mutex lock, `push_back` per tick and an `std::all_of` scan.
+ *
+ * Every IP gets non-decreasing cumulative counters; one IP in 8 stops early and leaves
+ * trailing zeros, like a window the poller overran. The outputs of both versions are
+ * compared before timing.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 bench_delta_kernel.cpp -o bench_delta_kernel
+ * Run:
+ *   ./bench_delta_kernel [num_ips=10000] [ticks=4000] [windows=5]
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "tc_common.h"
+#include "window_store.h"
+#include "delta_kernel.h"
+
+std::shared_mutex data_mutex;
+
+// The delta function before the batched kernel, kept here as the baseline.
+std::vector<__u64> get_diff_vector(
+    const __u64* snapshot, const size_t n, __u64& last_seen, size_t& valid_len) {
+    std::vector<__u64> diff;
+    valid_len = 0;
+    if (n == 0) return diff;
+
+    std::unique_lock lock(data_mutex);
+
+    if (snapshot[0] < last_seen)
+        last_seen = snapshot[0];
+    diff.push_back(snapshot[0] - last_seen);
+    __u64 pre = snapshot[0];
+    valid_len = 1;
+    for (size_t i = 1; i < n; ++i) {
+        if (snapshot[i - 1] > 0 && snapshot[i] == 0)
+            break;
+        if (snapshot[i] < pre) {
+            last_seen = pre;
+            break;
+        }
+        diff.push_back(snapshot[i] - pre);
+        pre = snapshot[i];
+        valid_len += 1;
+    }
+    last_seen = snapshot[valid_len - 1];
+
+    bool all_zero = std::all_of(diff.begin(), diff.end(),
+                            [](auto v){ return v == 0; });
+    if (all_zero) {
+        valid_len = 0;
+        return {};
+    }
+
+    return diff;
+}
+
+// The batched kernel with the SIMD paths disabled.
+template <typename Key>
+void window_deltas_scalar(const WindowStore<Key>& window, __u64* last_seen, DeltaWindow& out) {
+    const size_t n = window.ticks();
+    out.resize(window.size(), n);
+    for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+        const WindowMetric metric = static_cast<WindowMetric>(m);
+        for (size_t r = 0; r < window.size(); ++r) {
+            const __u64* cum = window.row(r, metric);
+            __u64& seen = last_seen[r * NUM_WINDOW_METRICS + m];
+            __u64* d = out.row(r, metric);
+            if (cum[0] < seen) seen = cum[0];
+            d[0] = cum[0] - seen;
+            __u64 nonzero = d[0];
+            size_t len = row_deltas_scalar(cum, 1, n, d, nonzero);
+            seen = cum[len - 1];
+            out.valid_len(r, metric) = nonzero ? static_cast<uint32_t>(len) : 0;
+        }
+    }
+}
+
+static void fill_window(WindowStore<uint32_t>& window, size_t num_ips, size_t ticks) {
+    std::mt19937_64 rng(42);
+    window.init(ticks);
+    for (size_t i = 0; i < num_ips; ++i) {
+        size_t r = window.find_or_insert(static_cast<uint32_t>(i + 1));
+        size_t filled = (i % 8 == 7) ? ticks * 3 / 4 : ticks;     // trailing zeros
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            __u64* row = window.row(r, static_cast<WindowMetric>(m));
+            __u64 v = 1000 + i;
+            for (size_t t = 0; t < filled; ++t) {
+                v += (rng() % 4 == 0) ? 0 : rng() % 1500;
+                row[t] = v;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t num_ips = argc > 1 ? std::stoul(argv[1]) : 10000;
+    size_t ticks = argc > 2 ? std::stoul(argv[2]) : 4000;
+    size_t windows = argc > 3 ? std::stoul(argv[3]) : 5;
+
+    WindowStore<uint32_t> window;
+    fill_window(window, num_ips, ticks);
+    const size_t rows = window.size();
+    std::vector<__u64> seed(rows * NUM_WINDOW_METRICS);
+    for (size_t r = 0; r < rows; ++r)
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            seed[r * NUM_WINDOW_METRICS + m] = window.row(r, static_cast<WindowMetric>(m))[0] / 2;
+
+    // Check that the kernel matches the baseline.
+    DeltaWindow out;
+    std::vector<__u64> seen = seed;
+    window_deltas(window, seen.data(), out);
+    size_t mismatches = 0;
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            WindowMetric metric = static_cast<WindowMetric>(m);
+            __u64 old_seen = seed[r * NUM_WINDOW_METRICS + m];
+            size_t valid_len;
+            auto diff = get_diff_vector(window.row(r, metric), ticks, old_seen, valid_len);
+            if (valid_len != out.valid_len(r, metric) || old_seen != seen[r * NUM_WINDOW_METRICS + m]
+                || !std::equal(diff.begin(), diff.end(), out.row(r, metric)))
+                mismatches += 1;
+        }
+    }
+    std::printf("%zu IPs x %zu ticks, %zu windows; %zu mismatching rows\n", num_ips, ticks, windows, mismatches);
+
+    auto time_windows = [&](const char* name, auto body) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t w = 0; w < windows; ++w) {
+            seen = seed;
+            body();
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count() / windows;
+        std::printf("%-18s %9.2f ms/window  %6.3f ns/tick\n", name, ms,
+                    ms * 1e6 / (rows * NUM_WINDOW_METRICS * ticks));
+    };
+
+    time_windows("get_diff_vector", [&]() {
+        for (size_t r = 0; r < rows; ++r) {
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                size_t valid_len;
+                auto diff = get_diff_vector(window.row(r, static_cast<WindowMetric>(m)), ticks,
+                                            seen[r * NUM_WINDOW_METRICS + m], valid_len);
+                asm volatile("" : : "r"(diff.data()) : "memory");
+            }
+        }
+    });
+    time_windows("batched scalar", [&]() { window_deltas_scalar(window, seen.data(), out); });
+    time_windows("batched simd", [&]() { window_deltas(window, seen.data(), out); });
+    return mismatches ? 1 : 0;
+}
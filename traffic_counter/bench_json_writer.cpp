@@ -0,0 +1,225 @@
+/**
+ * Benchmark of the per-second report serialization: the streaming `ReportWriter`
+ * (json_writer.h) against the previous json.hpp path, which built a `nlohmann::json`
+ * tree (`j_ip` per IP, `j_ts`, `record`) and called `dump()`.
+ *
+ * The window's deltas come from `window_deltas()` over random cumulative counters; one
+ * IP in 4 has no UDP traffic and one in 16 none at all. The outputs of both versions
+ * are compared byte for byte, in the "deltas", "rates" and "timestamps" export modes,
+ * before timing.
+ *
+ * Then a bursty window (one tick in 100 carries traffic) is written with every
+ * `BinEncoding`; the sparse and run-length encoded reports are decoded and compared with
+ * the dense one.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 bench_json_writer.cpp -o bench_json_writer
+ * Run:
+ *   ./bench_json_writer [num_ips=500] [ticks=4000] [windows=5]
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "window_store.h"
+#include "delta_kernel.h"
+#include "json_writer.h"
+
+using json = nlohmann::json;
+
+// The serialization before the streaming writer, kept here as the baseline.
+std::string dump_with_json(const time_t second, const WindowStore<uint32_t>& window,
+    const DeltaWindow& deltas, const double* tick_dt_s, const std::vector<__u64>& tick_ns) {
+    json j_ts;
+    for (size_t r = 0; r < window.size(); ++r) {
+        json j_ip;
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            const WindowMetric metric = static_cast<WindowMetric>(m);
+            const size_t valid_len = deltas.valid_len(r, metric);
+            const __u64* d = deltas.row(r, metric);
+            if (valid_len == 0)
+                continue;
+            if (tick_dt_s) {
+                std::vector<double> rates(valid_len);
+                for (size_t i = 0; i < valid_len; ++i)
+                    rates[i] = d[i] / tick_dt_s[i];
+                j_ip[METRIC_NAMES[m]] = rates;
+            } else {
+                j_ip[METRIC_NAMES[m]] = std::vector<__u64>(d, d + valid_len);
+            }
+        }
+        if (j_ip.empty())
+            continue;
+        j_ts[std::to_string(window.key(r))] = j_ip;
+    }
+    if (j_ts.empty())
+        return {};
+    if (!tick_ns.empty())
+        j_ts["tick_ns"] = tick_ns;
+
+    json record;
+    record[std::to_string(second)] = j_ts;
+    return record.dump();
+}
+
+const std::string& dump_with_writer(ReportWriter& report, const time_t second,
+    const WindowStore<uint32_t>& window, const DeltaWindow& deltas, const double* tick_dt_s,
+    const std::vector<__u64>& tick_ns) {
+    static const std::string none;
+    report.clear();
+    for (size_t r = 0; r < window.size(); ++r) {
+        append_u64(report.label_buf(), window.key(r));
+        report.add_row(deltas, r);
+    }
+    if (report.empty())
+        return none;
+    return report.write(second, tick_dt_s, tick_ns.empty() ? nullptr : tick_ns.data(), tick_ns.size());
+}
+
+// Expand a "sparse" or "rle" bin array back to the dense deltas.
+std::vector<__u64> decode_bins(const json& j) {
+    std::vector<__u64> dense;
+    if (j.is_object()) {
+        dense.assign(j["len"].get<size_t>(), 0);
+        for (size_t k = 0; k < j["idx"].size(); ++k)
+            dense[j["idx"][k].get<size_t>()] = j["val"][k].get<__u64>();
+        return dense;
+    }
+    for (const auto& v : j) {
+        if (v.is_number_integer() && v.get<int64_t>() < 0)
+            dense.insert(dense.end(), static_cast<size_t>(-v.get<int64_t>()), 0);
+        else
+            dense.push_back(v.get<__u64>());
+    }
+    return dense;
+}
+
+bool same_report(const std::string& dense, const std::string& encoded) {
+    json a = json::parse(dense), b = json::parse(encoded);
+    for (auto& [second, ips] : b.items())
+        for (auto& [ip, metrics] : ips.items())
+            for (auto& [name, bins] : metrics.items())
+                bins = decode_bins(bins);
+    return a == b;
+}
+
+static void fill_window(WindowStore<uint32_t>& window, size_t num_ips, size_t ticks,
+    size_t busy_every = 1) {
+    std::mt19937_64 rng(42);
+    window.init(ticks);
+    for (size_t i = 0; i < num_ips; ++i) {
+        size_t r = window.find_or_insert(static_cast<uint32_t>(rng()));
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            const bool idle = (i % 16 == 15) || (i % 4 == 3 && m >= UDP_BYTES);
+            __u64* row = window.row(r, static_cast<WindowMetric>(m));
+            __u64 v = 1000 + i;
+            for (size_t t = 0; t < ticks; ++t) {
+                if (!idle && rng() % busy_every == 0)
+                    v += (rng() % 4 == 0) ? 0 : rng() % 1500;
+                row[t] = v;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t num_ips = argc > 1 ? std::stoul(argv[1]) : 500;
+    size_t ticks = argc > 2 ? std::stoul(argv[2]) : 4000;
+    size_t windows = argc > 3 ? std::stoul(argv[3]) : 5;
+    const time_t second = 1760659200;
+
+    WindowStore<uint32_t> window;
+    fill_window(window, num_ips, ticks);
+    std::vector<__u64> seen(window.size() * NUM_WINDOW_METRICS);
+    for (size_t r = 0; r < window.size(); ++r)
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            seen[r * NUM_WINDOW_METRICS + m] = window.row(r, static_cast<WindowMetric>(m))[0];
+    DeltaWindow deltas;
+    window_deltas(window, seen.data(), deltas);
+
+    std::mt19937_64 rng(7);
+    std::vector<double> tick_dt_s(ticks);
+    std::vector<__u64> tick_ns(ticks);
+    __u64 ns = 1000000000ULL;
+    for (size_t t = 0; t < ticks; ++t) {
+        tick_dt_s[t] = (1e9 / ticks + static_cast<double>(rng() % 20000) - 10000) * 1e-9;
+        ns += static_cast<__u64>(tick_dt_s[t] * 1e9);
+        tick_ns[t] = ns;
+    }
+    const std::vector<__u64> no_ticks;
+
+    struct Mode {
+        const char* name;
+        const double* dt;
+        const std::vector<__u64>* ts;
+    };
+    const Mode modes[] = {
+        {"deltas", nullptr, &no_ticks},
+        {"rates", tick_dt_s.data(), &no_ticks},
+        {"timestamps", nullptr, &tick_ns},
+    };
+
+    ReportWriter report;
+    size_t mismatches = 0;
+    for (const Mode& mode : modes) {
+        const std::string expected = dump_with_json(second, window, deltas, mode.dt, *mode.ts);
+        if (dump_with_writer(report, second, window, deltas, mode.dt, *mode.ts) != expected) {
+            std::printf("%s: output differs from json.hpp\n", mode.name);
+            mismatches += 1;
+        }
+    }
+    std::printf("%zu IPs x %zu ticks, %zu windows; %zu mismatching modes\n", num_ips, ticks, windows, mismatches);
+
+    for (const Mode& mode : modes) {
+        auto time_windows = [&](const char* name, auto body) {
+            size_t bytes = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t w = 0; w < windows; ++w)
+                bytes = body();
+            auto end = std::chrono::steady_clock::now();
+            double ms = std::chrono::duration<double, std::milli>(end - start).count() / windows;
+            std::printf("%-10s %-8s %9.2f ms/window  %7.1f MB/s\n", mode.name, name, ms, bytes / ms / 1e3);
+        };
+        time_windows("json.hpp", [&]() {
+            return dump_with_json(second, window, deltas, mode.dt, *mode.ts).size();
+        });
+        time_windows("writer", [&]() {
+            return dump_with_writer(report, second, window, deltas, mode.dt, *mode.ts).size();
+        });
+    }
+
+    WindowStore<uint32_t> bursty;
+    fill_window(bursty, num_ips, ticks, 100);
+    for (size_t r = 0; r < bursty.size(); ++r)
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            seen[r * NUM_WINDOW_METRICS + m] = bursty.row(r, static_cast<WindowMetric>(m))[0];
+    window_deltas(bursty, seen.data(), deltas);
+
+    std::printf("bursty window, 1 tick in 100:\n");
+    report.set_encoding(BIN_DENSE);
+    const std::string dense = dump_with_writer(report, second, bursty, deltas, nullptr, no_ticks);
+    const std::pair<const char*, BinEncoding> encodings[] = {
+        {"dense", BIN_DENSE}, {"sparse", BIN_SPARSE}, {"rle", BIN_RLE}};
+    for (const auto& [name, encoding] : encodings) {
+        report.set_encoding(encoding);
+        const std::string encoded = dump_with_writer(report, second, bursty, deltas, nullptr, no_ticks);
+        if (!same_report(dense, encoded)) {
+            std::printf("%s: decodes to other bins than dense\n", name);
+            mismatches += 1;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (size_t w = 0; w < windows; ++w)
+            dump_with_writer(report, second, bursty, deltas, nullptr, no_ticks);
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count() / windows;
+        std::printf("%-10s %9.2f ms/window  %9.1f KB\n", name, ms, encoded.size() / 1e3);
+    }
+    return mismatches ? 1 : 0;
+}
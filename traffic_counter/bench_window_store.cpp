@@ -0,0 +1,154 @@
+/**
+ * Benchmark of the per-tick window append: the flat `WindowStore` against the previous
+ * `std::map<uint32_t, BinsPerIP>` of four std::vector per IP.
+ *
+ * Every tick writes the TCP and UDP counters of all IPs into the current window, like
+ * `append_snapshot_to_metric_bins()` at the polling rate; every `hz` ticks the window is
+ * exported and reset. The first window is warm-up and not measured.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 bench_window_store.cpp -o bench_window_store
+ * Run:
+ *   ./bench_window_store [num_ips=10000] [hz=4000] [seconds=3]
+ *
+ * Memory: one window is num_ips * hz * 32 bytes, i.e. 1.28 GB at the defaults.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "tc_common.h"
+#include "window_store.h"
+
+// Count heap allocations to check that the steady state allocates nothing.
+static size_t g_allocs = 0;
+
+void* operator new(size_t size) {
+    g_allocs += 1;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// The window layout before WindowStore, kept here as the baseline.
+struct BinsPerIP {
+    std::vector<__u64> tcp_bytes;
+    std::vector<__u64> tcp_packets;
+    std::vector<__u64> udp_bytes;
+    std::vector<__u64> udp_packets;
+
+    BinsPerIP() = default;
+    explicit BinsPerIP(size_t n)
+        : tcp_bytes(n, 0), tcp_packets(n, 0), udp_bytes(n, 0), udp_packets(n, 0) {}
+};
+
+using Snapshot = std::map<uint32_t, traffic_val_t>;
+
+static void append_map(std::map<uint32_t, BinsPerIP>& window, uint32_t tick, size_t hz,
+                       const Snapshot& tcp, const Snapshot& udp) {
+    for (const auto& [ip, val] : tcp) {
+        auto& bins = window[ip];
+        if (bins.tcp_bytes.empty())
+            bins = BinsPerIP(hz);
+        bins.tcp_bytes[tick] = val.bytes;
+        bins.tcp_packets[tick] = val.packets;
+    }
+    for (const auto& [ip, val] : udp) {
+        auto& bins = window[ip];
+        if (bins.udp_bytes.empty())
+            bins = BinsPerIP(hz);
+        bins.udp_bytes[tick] = val.bytes;
+        bins.udp_packets[tick] = val.packets;
+    }
+}
+
+static void reset_map(std::map<uint32_t, BinsPerIP>& window) {
+    for (auto& [ip, bins] : window) {
+        std::fill(bins.tcp_bytes.begin(), bins.tcp_bytes.end(), 0);
+        std::fill(bins.tcp_packets.begin(), bins.tcp_packets.end(), 0);
+        std::fill(bins.udp_bytes.begin(), bins.udp_bytes.end(), 0);
+        std::fill(bins.udp_packets.begin(), bins.udp_packets.end(), 0);
+    }
+}
+
+static void append_flat(WindowStore<uint32_t>& window, uint32_t tick, size_t hz,
+                        const Snapshot& tcp, const Snapshot& udp) {
+    if (window.ticks() != hz)
+        window.init(hz);
+    for (const auto& [ip, val] : tcp) {
+        size_t row = window.find_or_insert(ip);
+        window.row(row, TCP_BYTES)[tick] = val.bytes;
+        window.row(row, TCP_PACKETS)[tick] = val.packets;
+    }
+    for (const auto& [ip, val] : udp) {
+        size_t row = window.find_or_insert(ip);
+        window.row(row, UDP_BYTES)[tick] = val.bytes;
+        window.row(row, UDP_PACKETS)[tick] = val.packets;
+    }
+}
+
+template <typename Window, typename Append, typename Reset>
+static void run(const char* name, Window& window, Append append, Reset reset,
+                size_t num_ips, size_t hz, size_t seconds) {
+    Snapshot tcp, udp;
+    for (size_t i = 0; i < num_ips; ++i) {
+        uint32_t ip = 0x0A000000u + static_cast<uint32_t>(i) * 2654435761u;  // spread keys
+        tcp[ip] = traffic_val_t{i, i * 1500, 0};
+        udp[ip] = traffic_val_t{i, i * 9000, 0};
+    }
+
+    double total_ns = 0;
+    size_t measured_ticks = 0, measured_allocs = 0;
+    for (size_t sec = 0; sec < seconds; ++sec) {
+        size_t allocs_before = g_allocs;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t tick = 0; tick < hz; ++tick)
+            append(window, tick, hz, tcp, udp);
+        auto end = std::chrono::steady_clock::now();
+        reset(window);
+
+        if (sec == 0)
+            continue;  // warm-up: first-time row allocation
+        total_ns += std::chrono::duration<double, std::nano>(end - start).count();
+        measured_ticks += hz;
+        measured_allocs += g_allocs - allocs_before;
+    }
+
+    if (measured_ticks == 0) {
+        std::printf("%-10s no measured window, use seconds >= 2\n", name);
+        return;
+    }
+    double ns_per_tick = total_ns / measured_ticks;
+    std::printf("%-10s %8.1f us/tick  %6.2f ns/entry  %8.3f allocs/tick  tick budget %.1f%%\n",
+                name, ns_per_tick / 1000.0, ns_per_tick / (2.0 * num_ips),
+                static_cast<double>(measured_allocs) / measured_ticks,
+                100.0 * ns_per_tick / (1e9 / hz));
+}
+
+int main(int argc, char** argv) {
+    size_t num_ips = argc > 1 ? std::stoul(argv[1]) : 10000;
+    size_t hz = argc > 2 ? std::stoul(argv[2]) : 4000;
+    size_t seconds = argc > 3 ? std::stoul(argv[3]) : 3;
+
+    std::printf("%zu IPs x %zu Hz, %zu s (first second is warm-up)\n", num_ips, hz, seconds);
+    {
+        std::map<uint32_t, BinsPerIP> window;
+        run("std::map", window, append_map, reset_map, num_ips, hz, seconds);
+    }
+    {
+        WindowStore<uint32_t> window;
+        run("flat", window, append_flat, [](WindowStore<uint32_t>& w) { w.clear(); },
+            num_ips, hz, seconds);
+    }
+    return 0;
+}
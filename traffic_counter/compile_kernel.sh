@@ -1,6 +1,18 @@
 #!/bin/bash
 
 # Compile the kernel codes into ELF objects of the same names.
+#
+# Build-time options, set as env variables:
+#   PERCPU=1   Per-CPU counter maps (BPF_MAP_TYPE_LRU_PERCPU_HASH) instead of a shared LRU hash.
+#   MMAP=1     Dense-slot counters in a BPF_F_MMAPABLE array ("-b mmap" in the collector).
+#   BINS=1     In-kernel sub-second time bins per key ("-b bins" in the collector).
+#   RINGBUF=1  Per-key summary records through a BPF ring buffer ("-b ringbuf" in the collector).
+#   FLOW=1     Count per 5-tuple flow instead of per IP (hash maps only, combinable with PERCPU=1).
+#   IPV6=1     Also count IPv6 packets in the <map>6 hash map (combinable with PERCPU=1).
+#   VLAN=1     Strip up to two VLAN tags (802.1Q/QinQ) before the IP header.
+#   DECAP=1    Count VXLAN/GRE/IP-in-IP packets by the inner IPv4 header.
+#
+# Example: PERCPU=1 bash compile_kernel.sh
 
 # Kernel c code
 kernels=("kernel_ingress_tc" "kernel_egress_tc" "kernel_ingress_xdp")
@@ -13,12 +25,38 @@ else
     INC=""
 fi
 
+DEFS=""
+if [[ "$PERCPU" == "1" ]]; then
+    DEFS="$DEFS -DTC_PERCPU_MAP"
+fi
+if [[ "$MMAP" == "1" ]]; then
+    DEFS="$DEFS -DTC_MMAP_COUNTERS -mcpu=v3"
+fi
+if [[ "$BINS" == "1" ]]; then
+    DEFS="$DEFS -DTC_TIME_BINS -mcpu=v3"
+fi
+if [[ "$FLOW" == "1" ]]; then
+    DEFS="$DEFS -DTC_FLOW_KEYS"
+fi
+if [[ "$IPV6" == "1" ]]; then
+    DEFS="$DEFS -DTC_IPV6"
+fi
+if [[ "$VLAN" == "1" ]]; then
+    DEFS="$DEFS -DTC_VLAN"
+fi
+if [[ "$DECAP" == "1" ]]; then
+    DEFS="$DEFS -DTC_DECAP"
+fi
+if [[ "$RINGBUF" == "1" ]]; then
+    DEFS="$DEFS -DTC_RINGBUF -mcpu=v3"
+fi
+
 # Compile each file
 for kernel in "${kernels[@]}"; do
     cfile="${kernel}.c"
     obj="${kernel}.o"
     echo "Compiling $cfile -> $obj"
-    sudo clang -O2 -g -target bpf $INC -c "$cfile" -o "$obj"
+    sudo clang -O2 -g -target bpf $INC $DEFS -c "$cfile" -o "$obj"
     if [[ $? -ne 0 ]]; then
         echo "Compilation failed for $cfile"
         exit 1
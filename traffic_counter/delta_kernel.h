@@ -0,0 +1,185 @@
+/**
+ * Batched per-tick deltas of a window's cumulative counters.
+ *
+ * `window_deltas()` turns every row of every metric of a `WindowStore` into per-tick
+ * deltas in one pass over the contiguous bin matrices, writing into a reusable
+ * `DeltaWindow`. A row is valid up to its first decreasing tick (the trailing zeros of
+ * a window the poller did not fill); the subtraction and that monotonicity check run
+ * 4 (AVX2) or 2 (NEON) ticks at a time. AVX2 is picked at run time, so the collector
+ * needs no extra compile flags; AArch64 always has NEON.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef DELTA_KERNEL_H
+#define DELTA_KERNEL_H
+
+#include <linux/types.h>
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "window_store.h"
+
+// ++ Deltas of one window, laid out like the `WindowStore` it was computed from
+struct DeltaWindow {
+    /**
+     * @brief Size the buffers for `rows` x `ticks`; allocates only when they grow.
+     */
+    void resize(size_t rows, size_t ticks) {
+        rows_ = rows;
+        ticks_ = ticks;
+        if (deltas_[0].size() < rows * ticks)
+            for (auto& m : deltas_) m.resize(rows * ticks);
+        if (valid_len_.size() < rows * NUM_WINDOW_METRICS) {
+            valid_len_.resize(rows * NUM_WINDOW_METRICS);
+            reset_.resize(rows * NUM_WINDOW_METRICS);
+        }
+    }
+
+    __u64* row(size_t r, WindowMetric m) { return deltas_[m].data() + r * ticks_; }
+    const __u64* row(size_t r, WindowMetric m) const { return deltas_[m].data() + r * ticks_; }
+
+    // Number of deltas of the row, 0 if they are all zero.
+    uint32_t& valid_len(size_t r, WindowMetric m) { return valid_len_[r * NUM_WINDOW_METRICS + m]; }
+    uint32_t valid_len(size_t r, WindowMetric m) const { return valid_len_[r * NUM_WINDOW_METRICS + m]; }
+
+    // Whether the row's first value was below its last-seen value (a counter reset).
+    uint8_t& reset(size_t r, WindowMetric m) { return reset_[r * NUM_WINDOW_METRICS + m]; }
+    bool reset(size_t r, WindowMetric m) const { return reset_[r * NUM_WINDOW_METRICS + m] != 0; }
+
+    size_t size() const { return rows_; }
+    size_t ticks() const { return ticks_; }
+
+private:
+    size_t rows_ = 0;
+    size_t ticks_ = 0;
+    std::array<std::vector<__u64>, NUM_WINDOW_METRICS> deltas_;
+    std::vector<uint32_t> valid_len_;
+    std::vector<uint8_t> reset_;
+};
+
+/**
+ * @brief Scalar deltas of `cum[start..n)` against their predecessors, up to the first
+ *        decreasing tick.
+ *
+ * @return size_t  index of the first decreasing tick, or `n`.
+ */
+inline size_t row_deltas_scalar(const __u64* cum, size_t start, size_t n, __u64* out, __u64& nonzero) {
+    for (size_t i = start; i < n; ++i) {
+        if (cum[i] < cum[i - 1])
+            return i;
+        out[i] = cum[i] - cum[i - 1];
+        nonzero |= out[i];
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+inline size_t row_deltas_avx2(const __u64* cum, size_t n, __u64* out, __u64& nonzero) {
+    // AVX2 only compares signed 64-bit lanes: flip the sign bits for an unsigned compare.
+    const __m256i sign = _mm256_set1_epi64x(static_cast<long long>(1ULL << 63));
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 1;
+    for (; i + 4 <= n; i += 4) {
+        __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cum + i));
+        __m256i pre = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cum + i - 1));
+        __m256i dec = _mm256_cmpgt_epi64(_mm256_xor_si256(pre, sign), _mm256_xor_si256(cur, sign));
+        if (!_mm256_testz_si256(dec, dec))
+            break;  // the scalar tail finds the exact tick
+        __m256i diff = _mm256_sub_epi64(cur, pre);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), diff);
+        acc = _mm256_or_si256(acc, diff);
+    }
+    nonzero |= _mm256_testz_si256(acc, acc) ? 0 : 1;
+    return row_deltas_scalar(cum, i, n, out, nonzero);
+}
+
+inline bool cpu_has_avx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+#elif defined(__aarch64__)
+inline size_t row_deltas_neon(const __u64* cum, size_t n, __u64* out, __u64& nonzero) {
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i = 1;
+    for (; i + 2 <= n; i += 2) {
+        uint64x2_t cur = vld1q_u64(cum + i);
+        uint64x2_t pre = vld1q_u64(cum + i - 1);
+        uint64x2_t dec = vcltq_u64(cur, pre);
+        if (vgetq_lane_u64(dec, 0) | vgetq_lane_u64(dec, 1))
+            break;  // the scalar tail finds the exact tick
+        uint64x2_t diff = vsubq_u64(cur, pre);
+        vst1q_u64(out + i, diff);
+        acc = vorrq_u64(acc, diff);
+    }
+    nonzero |= vgetq_lane_u64(acc, 0) | vgetq_lane_u64(acc, 1);
+    return row_deltas_scalar(cum, i, n, out, nonzero);
+}
+#endif
+
+/**
+ * @brief Per-tick deltas of one row of `n` cumulative values.
+ *
+ * The first delta is taken against `last_seen`; a first value below it is a counter
+ * reset, flagged in `reset`, and counts from itself (delta 0). The row is valid up to
+ * its first decreasing tick. `last_seen` becomes the last valid value.
+ *
+ * @return size_t  number of valid deltas in `out`, or 0 if they are all zero.
+ */
+inline size_t row_deltas(const __u64* cum, size_t n, __u64& last_seen, __u64* out, bool& reset) {
+    reset = false;
+    if (n == 0)
+        return 0;
+    if (cum[0] < last_seen) {
+        reset = true;
+        last_seen = cum[0];
+    }
+    out[0] = cum[0] - last_seen;
+    __u64 nonzero = out[0];
+
+    size_t valid_len;
+#if defined(__x86_64__)
+    valid_len = cpu_has_avx2() ? row_deltas_avx2(cum, n, out, nonzero)
+                               : row_deltas_scalar(cum, 1, n, out, nonzero);
+#elif defined(__aarch64__)
+    valid_len = row_deltas_neon(cum, n, out, nonzero);
+#else
+    valid_len = row_deltas_scalar(cum, 1, n, out, nonzero);
+#endif
+    last_seen = cum[valid_len - 1];
+    return nonzero ? valid_len : 0;
+}
+
+/**
+ * @brief Deltas of all rows and metrics of `window` into `out`.
+ *
+ * @param last_seen  Last-seen value of every row and metric, `window.size()` x
+ *                   NUM_WINDOW_METRICS row-major; updated in place.
+ */
+template <typename Key>
+void window_deltas(const WindowStore<Key>& window, __u64* last_seen, DeltaWindow& out) {
+    const size_t n = window.ticks();
+    out.resize(window.size(), n);
+    for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+        const WindowMetric metric = static_cast<WindowMetric>(m);
+        for (size_t r = 0; r < window.size(); ++r) {
+            bool reset;
+            out.valid_len(r, metric) = static_cast<uint32_t>(row_deltas(
+                window.row(r, metric), n, last_seen[r * NUM_WINDOW_METRICS + m], out.row(r, metric), reset));
+            out.reset(r, metric) = reset;
+        }
+    }
+}
+
+#endif
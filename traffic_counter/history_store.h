@@ -0,0 +1,257 @@
+/**
+ * Compressed history of the collector's completed windows.
+ *
+ * Every exported `WindowStore` is appended as one immutable chunk. A chunk holds the
+ * window's keys (sorted, for lookups) and one byte stream per row and metric, plus one
+ * for the tick sampling times. A stream encodes its `ticks` cumulative values as:
+ *   - the first value, varint;
+ *   - the first delta, zigzag varint;
+ *   - every later delta-of-delta, zigzag varint.
+ * Steady or idle traffic is one byte per tick, so an hour of 1000 Hz bins of one IP
+ * (4 metrics) is about 15 MB instead of 115 MB of raw counters. The tick times, a few
+ * microseconds of jitter each, add about 8 MB per hour once for all the IPs of the store:
+ * a single IP takes about 22 MB per hour. Chunks older than the retention are dropped.
+ *
+ * `append()` is called by the exporter thread; the decoder API (`seconds()`, `decode()`,
+ * `decode_ticks()`, `for_each_key()`) may be used from any thread.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <linux/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <vector>
+
+#include "window_store.h"
+
+// ++ Codec of one series of cumulative values
+
+inline void history_put_varint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Return false on a truncated or overlong varint.
+inline bool history_get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+inline uint64_t zigzag_encode(const int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t zigzag_decode(const uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+/**
+ * @brief Append the delta-of-delta encoding of `vals[0..n)` to `out`. Lossless for any
+ *        values, including the decreases of a window's trailing zeros (modulo 2^64).
+ */
+inline void history_encode_series(const __u64* vals, const size_t n, std::vector<uint8_t>& out) {
+    if (n == 0)
+        return;
+    history_put_varint(out, vals[0]);
+    uint64_t prev_delta = 0;
+    for (size_t i = 1; i < n; ++i) {
+        uint64_t delta = vals[i] - vals[i - 1];
+        history_put_varint(out, zigzag_encode(static_cast<int64_t>(delta - prev_delta)));
+        prev_delta = delta;
+    }
+}
+
+/**
+ * @brief Decode `n` values encoded by `history_encode_series()` from `p`, advancing it.
+ *
+ * @return bool  false if the stream ends early.
+ */
+inline bool history_decode_series(const uint8_t*& p, const uint8_t* end, const size_t n, __u64* out) {
+    if (n == 0)
+        return true;
+    uint64_t v;
+    if (!history_get_varint(p, end, v))
+        return false;
+    out[0] = v;
+    uint64_t delta = 0;
+    for (size_t i = 1; i < n; ++i) {
+        if (!history_get_varint(p, end, v))
+            return false;
+        delta += static_cast<uint64_t>(zigzag_decode(v));
+        out[i] = out[i - 1] + delta;
+    }
+    return true;
+}
+
+template <typename Key>
+class HistoryStore {
+public:
+    /**
+     * @brief Keep the windows of the last `retention_sec` seconds; 0 disables the store.
+     */
+    void set_retention(time_t retention_sec) { retention_ = retention_sec; }
+    bool enabled() const { return retention_ > 0; }
+
+    /**
+     * @brief Encode the completed `window` of `second` and drop the chunks that fell out
+     *        of the retention. Call it before the window is cleared.
+     */
+    void append(const time_t second, const WindowStore<Key>& window) {
+        if (!enabled() || window.ticks() == 0)
+            return;
+
+        Chunk chunk;
+        chunk.second = second;
+        chunk.ticks = static_cast<uint32_t>(window.ticks());
+        const size_t rows = window.size();
+        order_.resize(rows);
+        std::iota(order_.begin(), order_.end(), 0);
+        std::sort(order_.begin(), order_.end(),
+                  [&](size_t a, size_t b) { return window.key(a) < window.key(b); });
+
+        scratch_.clear();
+        chunk.keys.reserve(rows);
+        chunk.offsets.reserve(rows * NUM_WINDOW_METRICS + 2);
+        chunk.offsets.push_back(0);
+        history_encode_series(window.tick_ns(), window.ticks(), scratch_);
+        for (size_t r : order_) {
+            chunk.keys.push_back(window.key(r));
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                chunk.offsets.push_back(static_cast<uint32_t>(scratch_.size()));
+                history_encode_series(window.row(r, static_cast<WindowMetric>(m)), window.ticks(), scratch_);
+            }
+        }
+        chunk.offsets.push_back(static_cast<uint32_t>(scratch_.size()));
+        chunk.bytes.assign(scratch_.begin(), scratch_.end());
+
+        std::unique_lock lock(mutex_);
+        bytes_ += chunk.memory_bytes();
+        chunks_.push_back(std::move(chunk));
+        while (!chunks_.empty() && chunks_.front().second <= second - retention_) {
+            bytes_ -= chunks_.front().memory_bytes();
+            chunks_.pop_front();
+        }
+    }
+
+    // Seconds of the windows held, oldest first.
+    std::vector<time_t> seconds() const {
+        std::shared_lock lock(mutex_);
+        std::vector<time_t> out;
+        out.reserve(chunks_.size());
+        for (const auto& c : chunks_) out.push_back(c.second);
+        return out;
+    }
+
+    /**
+     * @brief Cumulative values of `key` and metric `m` in the window of `second`.
+     *
+     * @return bool  false if the window is not held or the key is not in it.
+     */
+    bool decode(const time_t second, const Key& key, const WindowMetric m, std::vector<__u64>& out) const {
+        std::shared_lock lock(mutex_);
+        const Chunk* c = find(second);
+        if (!c)
+            return false;
+        auto it = std::lower_bound(c->keys.begin(), c->keys.end(), key);
+        if (it == c->keys.end() || !(*it == key))
+            return false;
+        return c->decode_stream(1 + static_cast<size_t>(it - c->keys.begin()) * NUM_WINDOW_METRICS + m, out);
+    }
+
+    /**
+     * @brief Sampling times (CLOCK_MONOTONIC ns) of the ticks of the window of `second`.
+     */
+    bool decode_ticks(const time_t second, std::vector<__u64>& out) const {
+        std::shared_lock lock(mutex_);
+        const Chunk* c = find(second);
+        return c && c->decode_stream(0, out);
+    }
+
+    /**
+     * @brief Call `fn(key, metric, values)` for every row and metric of the window of
+     *        `second`, keys in ascending order.
+     */
+    template <typename Fn>
+    bool for_each_key(const time_t second, Fn fn) const {
+        std::shared_lock lock(mutex_);
+        const Chunk* c = find(second);
+        if (!c)
+            return false;
+        std::vector<__u64> vals;
+        for (size_t k = 0; k < c->keys.size(); ++k) {
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                if (!c->decode_stream(1 + k * NUM_WINDOW_METRICS + m, vals))
+                    return false;
+                fn(c->keys[k], static_cast<WindowMetric>(m), vals);
+            }
+        }
+        return true;
+    }
+
+    size_t num_windows() const {
+        std::shared_lock lock(mutex_);
+        return chunks_.size();
+    }
+
+    // Heap bytes held by the chunks.
+    size_t memory_bytes() const {
+        std::shared_lock lock(mutex_);
+        return bytes_;
+    }
+
+private:
+    struct Chunk {
+        time_t second = 0;
+        uint32_t ticks = 0;
+        std::vector<Key> keys;              // ascending
+        std::vector<uint32_t> offsets;      // stream starts: ticks, then row x metric; plus the end
+        std::vector<uint8_t> bytes;
+
+        bool decode_stream(size_t s, std::vector<__u64>& out) const {
+            out.resize(ticks);
+            const uint8_t* p = bytes.data() + offsets[s];
+            return history_decode_series(p, bytes.data() + offsets[s + 1], ticks, out.data());
+        }
+
+        size_t memory_bytes() const {
+            return keys.capacity() * sizeof(Key) + offsets.capacity() * sizeof(uint32_t) + bytes.capacity();
+        }
+    };
+
+    // Chunks are appended in time order, so they are sorted by second.
+    const Chunk* find(time_t second) const {
+        auto it = std::lower_bound(chunks_.begin(), chunks_.end(), second,
+                                   [](const Chunk& c, time_t s) { return c.second < s; });
+        return (it != chunks_.end() && it->second == second) ? &*it : nullptr;
+    }
+
+    time_t retention_ = 0;
+    mutable std::shared_mutex mutex_;
+    std::deque<Chunk> chunks_;
+    size_t bytes_ = 0;
+    std::vector<size_t> order_;         // append() scratch, row order by key
+    std::vector<uint8_t> scratch_;      // append() scratch, encoded streams
+};
+
+#endif
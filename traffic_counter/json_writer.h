@@ -0,0 +1,374 @@
+/**
+ * Streaming JSON writer of the collector's per-second report.
+ *
+ * `JsonWriter` appends JSON text to one reusable buffer: no tree, no per-value
+ * allocation, integers formatted two digits at a time. `ReportWriter` serializes a
+ * whole per-second record from the exporter's `DeltaWindow`s with it, byte-identical to
+ * the `nlohmann::json::dump()` of the same record:
+ *   - object members in ascending key order (json objects are std::maps), no whitespace;
+ *   - strings escaped like `dump()` with `ensure_ascii` off;
+ *   - doubles in json.hpp's own shortest round-trip format, non-finite ones as null.
+ *
+ * The bin arrays of a row can also be written sparse or run-length encoded
+ * (`BinEncoding`), which is no longer what `dump()` would print but is much shorter for
+ * bursty or idle IPs, whose windows are mostly zero ticks.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <linux/types.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "json.hpp"     // number formatting of doubles only
+#include "window_store.h"
+#include "delta_kernel.h"
+
+inline unsigned count_digits(uint64_t v) {
+    unsigned n = 1;
+    for (;;) {
+        if (v < 10) return n;
+        if (v < 100) return n + 1;
+        if (v < 1000) return n + 2;
+        if (v < 10000) return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+/**
+ * @brief Write the decimal digits of `v` to `out` (at least 20 chars).
+ *
+ * @return size_t  number of chars written.
+ */
+inline size_t format_u64(char* out, uint64_t v) {
+    static constexpr char digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    const unsigned n = count_digits(v);
+    char* p = out + n;
+    while (v >= 100) {
+        const size_t i = (v % 100) * 2;
+        v /= 100;
+        *--p = digits[i + 1];
+        *--p = digits[i];
+    }
+    if (v >= 10) {
+        *--p = digits[v * 2 + 1];
+        *--p = digits[v * 2];
+    } else {
+        *--p = static_cast<char>('0' + v);
+    }
+    return n;
+}
+
+inline void append_u64(std::string& out, const uint64_t v) {
+    char buf[20];
+    out.append(buf, format_u64(buf, v));
+}
+
+class JsonWriter {
+public:
+    // Drop the text, keep the buffer.
+    void clear() { buf_.clear(); }
+    const std::string& str() const { return buf_; }
+    const char* data() const { return buf_.data(); }
+    size_t size() const { return buf_.size(); }
+
+    // Raw JSON syntax: braces, brackets, commas and colons.
+    void put(const char c) { buf_.push_back(c); }
+
+    void string(std::string_view s) {
+        buf_.push_back('"');
+        size_t plain = 0;
+        for (size_t i = 0; i < s.size(); ++i) {
+            const unsigned char c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            buf_.append(s.data() + plain, i - plain);
+            plain = i + 1;
+            buf_.push_back('\\');
+            switch (c) {
+            case '"':  buf_.push_back('"'); break;
+            case '\\': buf_.push_back('\\'); break;
+            case '\b': buf_.push_back('b'); break;
+            case '\f': buf_.push_back('f'); break;
+            case '\n': buf_.push_back('n'); break;
+            case '\r': buf_.push_back('r'); break;
+            case '\t': buf_.push_back('t'); break;
+            default: {
+                static constexpr char hex[] = "0123456789abcdef";
+                const char esc[5] = {'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                buf_.append(esc, sizeof(esc));
+            }
+            }
+        }
+        buf_.append(s.data() + plain, s.size() - plain);
+        buf_.push_back('"');
+    }
+
+    // `"key":`
+    void key(std::string_view k) {
+        string(k);
+        buf_.push_back(':');
+    }
+
+    void number(const uint64_t v) { append_u64(buf_, v); }
+
+    void number(const int64_t v) {
+        if (v < 0) {
+            buf_.push_back('-');
+            append_u64(buf_, 0 - static_cast<uint64_t>(v));
+        } else {
+            append_u64(buf_, static_cast<uint64_t>(v));
+        }
+    }
+
+    void number(const double v) {
+        if (!std::isfinite(v)) {
+            buf_.append("null", 4);
+            return;
+        }
+        char tmp[64];
+        const char* end = nlohmann::detail::to_chars(tmp, tmp + sizeof(tmp), v);
+        buf_.append(tmp, static_cast<size_t>(end - tmp));
+    }
+
+    // Room for `n` more chars to format in place; `commit()` the end of what was written.
+    char* reserve(const size_t n) {
+        const size_t start = buf_.size();
+        buf_.resize(start + n);
+        return &buf_[start];
+    }
+    void commit(const char* end) { buf_.resize(static_cast<size_t>(end - buf_.data())); }
+
+    // `[v0,v1,...]`
+    void array(const __u64* v, const size_t n) {
+        char* p = reserve(n * 21 + 2);
+        *p++ = '[';
+        for (size_t i = 0; i < n; ++i) {
+            if (i) *p++ = ',';
+            p += format_u64(p, v[i]);
+        }
+        *p++ = ']';
+        commit(p);
+    }
+
+    // `[v0/dt0,v1/dt1,...]`, per-second rates of per-tick deltas.
+    void rate_array(const __u64* v, const double* dt_s, const size_t n) {
+        buf_.push_back('[');
+        for (size_t i = 0; i < n; ++i) {
+            if (i) buf_.push_back(',');
+            number(v[i] / dt_s[i]);
+        }
+        buf_.push_back(']');
+    }
+
+private:
+    std::string buf_;
+};
+
+// How `ReportWriter` writes the bin array of `n` ticks of a metric.
+enum BinEncoding {
+    BIN_DENSE,      // [v0,v1,...], all n values
+    BIN_SPARSE,     // {"idx":[i,...],"len":n,"val":[v_i,...]}, the non-zero ticks only
+    BIN_RLE,        // [v0,-k,v3,...], every run of k >= 2 zero ticks as -k
+};
+
+// ++ Serializer of one per-second report, reused across windows
+class ReportWriter {
+public:
+    void set_encoding(const BinEncoding encoding) { encoding_ = encoding; }
+
+    // Start a new report; keeps all buffers.
+    void clear() {
+        rows_.clear();
+        labels_.clear();
+    }
+
+    bool empty() const { return rows_.empty(); }
+
+    // Buffer to append the label of the next row to, before `add_row()`.
+    std::string& label_buf() { return labels_; }
+
+    /**
+     * @brief Add row `r` of `deltas` under the label appended to `label_buf()` since the
+     *        previous row. A row without any valid delta is dropped with its label.
+     *        `deltas` must stay untouched until `write()`.
+     */
+    void add_row(const DeltaWindow& deltas, const size_t r) {
+        const size_t start = label_end();
+        bool has_deltas = false;
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            has_deltas |= deltas.valid_len(r, static_cast<WindowMetric>(m)) > 0;
+        if (!has_deltas) {
+            labels_.resize(start);
+            return;
+        }
+        rows_.push_back(Row{start, labels_.size() - start, &deltas, r});
+    }
+
+    /**
+     * @brief Serialize the report of `second`:
+     *        `{"<second>":{"<label>":{"tcp_bytes":[...],...},...,"tick_ns":[...]}}`.
+     *
+     * @param tick_dt_s  Tick durations to write per-second rates, nullptr to write deltas.
+     * @param tick_ns    Tick sampling times written as "tick_ns", nullptr for none.
+     * @return const std::string&  the JSON text, valid until the next `write()`.
+     */
+    const std::string& write(const time_t second, const double* tick_dt_s,
+        const __u64* tick_ns, const size_t num_ticks) {
+        if (tick_ns) {
+            const size_t start = label_end();
+            labels_.append("tick_ns");
+            rows_.push_back(Row{start, labels_.size() - start, nullptr, 0});
+        }
+        const std::string& labels = labels_;
+        auto label = [&labels](const Row& row) {
+            return std::string_view(labels).substr(row.label_off, row.label_len);
+        };
+        std::sort(rows_.begin(), rows_.end(),
+                  [&](const Row& a, const Row& b) { return label(a) < label(b); });
+
+        out_.clear();
+        out_.put('{');
+        out_.put('"');
+        out_.number(static_cast<int64_t>(second));
+        out_.put('"');
+        out_.put(':');
+        out_.put('{');
+        for (size_t i = 0; i < rows_.size(); ++i) {
+            const Row& row = rows_[i];
+            if (i) out_.put(',');
+            out_.key(label(row));
+            if (!row.deltas) {
+                out_.array(tick_ns, num_ticks);
+                continue;
+            }
+            out_.put('{');
+            bool first = true;
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                const WindowMetric metric = static_cast<WindowMetric>(m);
+                const size_t len = row.deltas->valid_len(row.r, metric);
+                if (len == 0)
+                    continue;
+                if (!first) out_.put(',');
+                first = false;
+                out_.key(METRIC_NAMES[m]);
+                bins(row.deltas->row(row.r, metric), tick_dt_s, len);
+            }
+            out_.put('}');
+        }
+        out_.put('}');
+        out_.put('}');
+        return out_.str();
+    }
+
+private:
+    // One bin array of `n` deltas, or of their rates over `dt_s`, in `encoding_`.
+    void bins(const __u64* d, const double* dt_s, const size_t n) {
+        if (encoding_ == BIN_DENSE) {
+            if (dt_s)
+                out_.rate_array(d, dt_s, n);
+            else
+                out_.array(d, n);
+            return;
+        }
+
+        if (encoding_ == BIN_SPARSE) {
+            // Branch-free gather of the non-zero ticks, then format only those.
+            if (nonzero_.size() < n)
+                nonzero_.resize(n);
+            size_t k = 0;
+            for (size_t i = 0; i < n; ++i) {
+                nonzero_[k] = static_cast<uint32_t>(i);
+                k += d[i] != 0;
+            }
+            out_.put('{');
+            out_.key("idx");
+            char* p = out_.reserve(k * 21 + 2);
+            *p++ = '[';
+            for (size_t j = 0; j < k; ++j) {
+                if (j) *p++ = ',';
+                p += format_u64(p, nonzero_[j]);
+            }
+            *p++ = ']';
+            out_.commit(p);
+            out_.put(',');
+            out_.key("len");
+            out_.number(static_cast<uint64_t>(n));
+            out_.put(',');
+            out_.key("val");
+            if (dt_s) {
+                out_.put('[');
+                for (size_t j = 0; j < k; ++j) {
+                    if (j) out_.put(',');
+                    out_.number(d[nonzero_[j]] / dt_s[nonzero_[j]]);
+                }
+                out_.put(']');
+            } else {
+                p = out_.reserve(k * 21 + 2);
+                *p++ = '[';
+                for (size_t j = 0; j < k; ++j) {
+                    if (j) *p++ = ',';
+                    p += format_u64(p, d[nonzero_[j]]);
+                }
+                *p++ = ']';
+                out_.commit(p);
+            }
+            out_.put('}');
+            return;
+        }
+
+        // Every run of >= 2 zero ticks as its negative length.
+        out_.put('[');
+        for (size_t i = 0; i < n;) {
+            if (i) out_.put(',');
+            size_t run = 0;
+            while (i + run < n && d[i + run] == 0)
+                ++run;
+            if (run >= 2) {
+                out_.number(-static_cast<int64_t>(run));
+                i += run;
+            } else {
+                if (dt_s)
+                    out_.number(d[i] / dt_s[i]);
+                else
+                    out_.number(static_cast<uint64_t>(d[i]));
+                ++i;
+            }
+        }
+        out_.put(']');
+    }
+
+    struct Row {
+        size_t label_off;
+        size_t label_len;
+        const DeltaWindow* deltas;  // nullptr for the "tick_ns" member
+        size_t r;
+    };
+
+    size_t label_end() const {
+        return rows_.empty() ? 0 : rows_.back().label_off + rows_.back().label_len;
+    }
+
+    std::vector<Row> rows_;
+    std::string labels_;        // all row labels, back to back
+    BinEncoding encoding_ = BIN_DENSE;
+    std::vector<uint32_t> nonzero_;     // BIN_SPARSE scratch, indices of the non-zero ticks
+    JsonWriter out_;
+};
+
+#endif
@@ -18,16 +18,29 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_endian.h>  // #define bpf_ntohs(x)
 
-#include "tc_common.h" // header file for this project only
+#include "tc_kern.h" // header file for this project only
 
-/// TODO: check if PERCORE eBPF Map is needed to meet the high speed traffic needs.
+#if defined(TC_MMAP_COUNTERS)
+TC_MMAP_MAPS(map_out_tc)
+#elif defined(TC_TIME_BINS)
+TC_BINS_MAPS(map_out_tc)
+#elif defined(TC_RINGBUF)
+TC_RINGBUF_MAPS(map_out_tc)
+#else
+// LRU_HASH by default, LRU_PERCPU_HASH when built with -DTC_PERCPU_MAP.
+// Keyed by traffic_flow_key_t when built with -DTC_FLOW_KEYS.
 struct {
-    __uint(type, BPF_MAP_TYPE_LRU_HASH);
-    /// TODO: fixed number of entries will cause loss of statistics.
+    __uint(type, TC_COUNTER_MAP_TYPE);
+    // Default size; the collector resizes it before loading with --load/--max-entries.
     __uint(max_entries, 2048);
-    __type(key, struct traffic_key_t);
+    __type(key, TC_KEY_TYPE);
     __type(value, struct traffic_val_t);
 } map_out_tc SEC(".maps");
+#ifdef TC_IPV6
+TC_IPV6_MAP(map_out_tc)
+#endif
+#endif
+TC_OVERFLOW_MAP(map_out_tc)
 
 /** Section to acctach to the TC egress rule via: 
  * sudo tc qdisc add dev <net_iface> clsact
@@ -38,18 +51,28 @@ int tc_egress(struct __sk_buff *skb) {
     void *data = (void *)(long)skb->data;
     void *data_end = (void *)(long)skb->data_end;
 
-    // Parse Ethernet header. Only process IPv4.
-    struct ethhdr *eth = data;
-    if ((void *)(eth + 1) > data_end)
+    // Parse Ethernet header. Only process IPv4 (and IPv6 with -DTC_IPV6).
+    __be16 h_proto;
+    void *l3 = tc_walk_eth(data, data_end, &h_proto);  // skips VLAN tags with -DTC_VLAN
+    if (!l3)
         return TC_ACT_OK;
 
-    if (eth->h_proto != __constant_htons(ETH_P_IP))
+#ifdef TC_IPV6
+    if (h_proto == bpf_htons(ETH_P_IPV6)) {
+        if (tc_count_ipv6(&map_out_tc6, l3, data_end, 1) < 0)
+            tc_count_overflow(&map_out_tc_ovf);
+        return TC_ACT_OK;
+    }
+#endif
+
+    if (h_proto != bpf_htons(ETH_P_IP))
         return TC_ACT_OK;
 
     // Parse IP header
-    struct iphdr *ip = (void *)(eth + 1);
+    struct iphdr *ip = l3;
     if ((void *)(ip + 1) > data_end)
         return TC_ACT_OK;
+    ip = tc_walk_ipv4(ip, data_end);  // inner IPv4 header of a tunnel with -DTC_DECAP
 
     struct traffic_key_t key = {
         .ip = ip->daddr,
@@ -63,17 +86,23 @@ int tc_egress(struct __sk_buff *skb) {
     if (key.proto != IPPROTO_TCP && key.proto != IPPROTO_UDP)
     return TC_ACT_OK;
 
-    struct traffic_val_t *val = bpf_map_lookup_elem(&map_out_tc, &key);
-    if (!val) {
-        struct traffic_val_t zero = {};
-        bpf_map_update_elem(&map_out_tc, &key, &zero, BPF_ANY);
-        val = bpf_map_lookup_elem(&map_out_tc, &key);
-        if (!val)
-            return TC_ACT_OK;
-    }
-
-    __sync_fetch_and_add(&val->packets, 1);
-    __sync_fetch_and_add(&val->bytes, bpf_ntohs(ip->tot_len));
+    int err;
+#if defined(TC_MMAP_COUNTERS)
+    err = tc_count_mmap(&map_out_tc_idx, &map_out_tc_ctr, &map_out_tc_key, &key, bpf_ntohs(ip->tot_len));
+#elif defined(TC_TIME_BINS)
+    err = tc_count_bins(&map_out_tc, &map_out_tc_cfg, &map_out_tc_zero, &key, bpf_ntohs(ip->tot_len));
+#elif defined(TC_RINGBUF)
+    err = tc_count_ringbuf(&map_out_tc, &map_out_tc_rb, &map_out_tc_cfg, &key, bpf_ntohs(ip->tot_len));
+#elif defined(TC_FLOW_KEYS)
+    struct traffic_flow_key_t flow;
+    if (tc_fill_flow_key(&flow, ip, data_end) < 0)
+        return TC_ACT_OK;
+    err = tc_count_hash(&map_out_tc, &flow, bpf_ntohs(ip->tot_len));
+#else
+    err = tc_count_hash(&map_out_tc, &key, bpf_ntohs(ip->tot_len));
+#endif
+    if (err < 0)
+        tc_count_overflow(&map_out_tc_ovf);
 
     return TC_ACT_OK;
 }
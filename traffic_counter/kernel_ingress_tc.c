@@ -17,16 +17,29 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_endian.h>  // #define bpf_ntohs(x) 
 
-#include "tc_common.h" // header file for this project only
+#include "tc_kern.h" // header file for this project only
 
-/// TODO: check if PERCORE eBPF Map is needed to meet the high speed traffic needs.
+#if defined(TC_MMAP_COUNTERS)
+TC_MMAP_MAPS(map_in_tc)
+#elif defined(TC_TIME_BINS)
+TC_BINS_MAPS(map_in_tc)
+#elif defined(TC_RINGBUF)
+TC_RINGBUF_MAPS(map_in_tc)
+#else
+// LRU_HASH by default, LRU_PERCPU_HASH when built with -DTC_PERCPU_MAP.
+// Keyed by traffic_flow_key_t when built with -DTC_FLOW_KEYS.
 struct {
-    __uint(type, BPF_MAP_TYPE_LRU_HASH);
-    /// TODO: fixed number of entries will cause loss of statistics.
+    __uint(type, TC_COUNTER_MAP_TYPE);
+    // Default size; the collector resizes it before loading with --load/--max-entries.
     __uint(max_entries, 2048);
-    __type(key, struct traffic_key_t);
+    __type(key, TC_KEY_TYPE);
     __type(value, struct traffic_val_t);
 } map_in_tc SEC(".maps");
+#ifdef TC_IPV6
+TC_IPV6_MAP(map_in_tc)
+#endif
+#endif
+TC_OVERFLOW_MAP(map_in_tc)
 
 /** Section to acctach to the TC ingress rule via: 
  * sudo tc qdisc add dev <net_iface> clsact
@@ -38,16 +51,26 @@ int tc_egress(struct __sk_buff *skb) {
     void *data_end = (void *)(long)skb->data_end;  // end of the packet
 
     // Memory overflow examination is a must-have to pass the eBPF program compiling.
-    struct ethhdr *eth = data;
-    if ((void *)(eth + 1) > data_end)
+    __be16 h_proto;
+    void *l3 = tc_walk_eth(data, data_end, &h_proto);  // skips VLAN tags with -DTC_VLAN
+    if (!l3)
         return TC_ACT_OK;
 
-    if (eth->h_proto != bpf_htons(ETH_P_IP)) // Only process IPv4
+#ifdef TC_IPV6
+    if (h_proto == bpf_htons(ETH_P_IPV6)) {
+        if (tc_count_ipv6(&map_in_tc6, l3, data_end, 0) < 0)
+            tc_count_overflow(&map_in_tc_ovf);
+        return TC_ACT_OK;
+    }
+#endif
+
+    if (h_proto != bpf_htons(ETH_P_IP)) // Only process IPv4 from here on
         return TC_ACT_OK;
 
-    struct iphdr *ip = (void *)(eth + 1);
+    struct iphdr *ip = l3;
     if ((void *)(ip + 1) > data_end)
         return TC_ACT_OK;
+    ip = tc_walk_ipv4(ip, data_end);  // inner IPv4 header of a tunnel with -DTC_DECAP
 
     // Track by source IP, network-order, big endian
     // The CPU is small endian.
@@ -65,20 +88,25 @@ int tc_egress(struct __sk_buff *skb) {
     if (key.proto != IPPROTO_TCP && key.proto != IPPROTO_UDP)
         return TC_ACT_OK;
 
-    struct traffic_val_t *val = bpf_map_lookup_elem(&map_in_tc, &key);
-    if (!val) {
-        // Create a new map entry. Fill the key not the value
-        struct traffic_val_t zero = {};
-        bpf_map_update_elem(&map_in_tc, &key, &zero, BPF_ANY);
-        val = bpf_map_lookup_elem(&map_in_tc, &key);
-        if (!val)
-            return TC_ACT_OK;
-    }
-
     // Update the Map's value field.
     __u16 payload_len = bpf_ntohs(ip->tot_len);  // L3 and above length
-    __sync_fetch_and_add(&val->packets, 1);
-    __sync_fetch_and_add(&val->bytes, payload_len);
+    int err;
+#if defined(TC_MMAP_COUNTERS)
+    err = tc_count_mmap(&map_in_tc_idx, &map_in_tc_ctr, &map_in_tc_key, &key, payload_len);
+#elif defined(TC_TIME_BINS)
+    err = tc_count_bins(&map_in_tc, &map_in_tc_cfg, &map_in_tc_zero, &key, payload_len);
+#elif defined(TC_RINGBUF)
+    err = tc_count_ringbuf(&map_in_tc, &map_in_tc_rb, &map_in_tc_cfg, &key, payload_len);
+#elif defined(TC_FLOW_KEYS)
+    struct traffic_flow_key_t flow;
+    if (tc_fill_flow_key(&flow, ip, data_end) < 0)
+        return TC_ACT_OK;
+    err = tc_count_hash(&map_in_tc, &flow, payload_len);
+#else
+    err = tc_count_hash(&map_in_tc, &key, payload_len);
+#endif
+    if (err < 0)
+        tc_count_overflow(&map_in_tc_ovf);
         
     return TC_ACT_OK;
 }
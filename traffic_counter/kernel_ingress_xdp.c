@@ -20,17 +20,30 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_endian.h>
 
-#include "tc_common.h"
+#include "tc_kern.h"
 
 // If the map name ("map_in_xdp" here) is too long, it will be truncated.
-/// TODO: check if PERCORE eBPF Map is needed to meet the high speed traffic needs.
+#if defined(TC_MMAP_COUNTERS)
+TC_MMAP_MAPS(map_in_xdp)
+#elif defined(TC_TIME_BINS)
+TC_BINS_MAPS(map_in_xdp)
+#elif defined(TC_RINGBUF)
+TC_RINGBUF_MAPS(map_in_xdp)
+#else
+// LRU_HASH by default, LRU_PERCPU_HASH when built with -DTC_PERCPU_MAP.
+// Keyed by traffic_flow_key_t when built with -DTC_FLOW_KEYS.
 struct {
-    __uint(type, BPF_MAP_TYPE_LRU_HASH);
-    /// TODO: fixed number of entries will cause loss of statistics.
+    __uint(type, TC_COUNTER_MAP_TYPE);
+    // Default size; the collector resizes it before loading with --load/--max-entries.
     __uint(max_entries, 2048);
-    __type(key, struct traffic_key_t);
+    __type(key, TC_KEY_TYPE);
     __type(value, struct traffic_val_t);
 } map_in_xdp SEC(".maps");  // "map_in_xdp" will the map name to be attached to network devices
+#ifdef TC_IPV6
+TC_IPV6_MAP(map_in_xdp)
+#endif
+#endif
+TC_OVERFLOW_MAP(map_in_xdp)
 
 
 /* Section to attach via `ip link set dev <net_iface> xdp obj <xdp_kernel_obj>.o sec <sec_name>` */
@@ -40,16 +53,26 @@ int xdp_ingress(struct xdp_md *ctx) {
     void *data_end = (void *)(long)ctx->data_end;
 
     // Memory overflow examination is a must-have to pass the eBPF program compiling.
-    struct ethhdr *eth = data;
-    if ((void *)(eth + 1) > data_end)
+    __be16 h_proto;
+    void *l3 = tc_walk_eth(data, data_end, &h_proto);  // skips VLAN tags with -DTC_VLAN
+    if (!l3)
         return XDP_PASS;  // return values differ from those of TC programs
 
-    if (eth->h_proto != bpf_htons(ETH_P_IP))
+#ifdef TC_IPV6
+    if (h_proto == bpf_htons(ETH_P_IPV6)) {
+        if (tc_count_ipv6(&map_in_xdp6, l3, data_end, 0) < 0)
+            tc_count_overflow(&map_in_xdp_ovf);
+        return XDP_PASS;
+    }
+#endif
+
+    if (h_proto != bpf_htons(ETH_P_IP))
         return XDP_PASS;
 
-    struct iphdr *ip = data + sizeof(*eth);
+    struct iphdr *ip = l3;
     if ((void *)(ip + 1) > data_end)
         return XDP_PASS;
+    ip = tc_walk_ipv4(ip, data_end);  // inner IPv4 header of a tunnel with -DTC_DECAP
 
     struct traffic_key_t key = {
         .ip = ip->saddr,
@@ -64,20 +87,24 @@ int xdp_ingress(struct xdp_md *ctx) {
     if (key.proto != IPPROTO_TCP && key.proto != IPPROTO_UDP)
         return XDP_PASS;
 
-    struct traffic_val_t *val = bpf_map_lookup_elem(&map_in_xdp, &key);
-    if (!val) {
-        // Create a new map entry. Fill the key not the value
-        struct traffic_val_t zero = {};
-        bpf_map_update_elem(&map_in_xdp, &key, &zero, BPF_ANY);
-        val = bpf_map_lookup_elem(&map_in_xdp, &key);
-        if (!val)
-            return XDP_PASS;
-    }
-
-    // Update the Map's value field.
-    __u16 payload_len = bpf_ntohs(ip->tot_len);  // L3 and above length
-    __sync_fetch_and_add(&val->packets, 1);
-    __sync_fetch_and_add(&val->bytes, payload_len);
+    __u16 payload_len = bpf_ntohs(ip->tot_len);
+    int err;
+#if defined(TC_MMAP_COUNTERS)
+    err = tc_count_mmap(&map_in_xdp_idx, &map_in_xdp_ctr, &map_in_xdp_key, &key, payload_len);
+#elif defined(TC_TIME_BINS)
+    err = tc_count_bins(&map_in_xdp, &map_in_xdp_cfg, &map_in_xdp_zero, &key, payload_len);
+#elif defined(TC_RINGBUF)
+    err = tc_count_ringbuf(&map_in_xdp, &map_in_xdp_rb, &map_in_xdp_cfg, &key, payload_len);
+#elif defined(TC_FLOW_KEYS)
+    struct traffic_flow_key_t flow;
+    if (tc_fill_flow_key(&flow, ip, data_end) < 0)
+        return XDP_PASS;
+    err = tc_count_hash(&map_in_xdp, &flow, payload_len);
+#else
+    err = tc_count_hash(&map_in_xdp, &key, payload_len);
+#endif
+    if (err < 0)
+        tc_count_overflow(&map_in_xdp_ovf);
 
     return XDP_PASS;
 }
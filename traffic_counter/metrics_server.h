@@ -0,0 +1,225 @@
+/**
+ * Loopback HTTP listener serving the collector's metrics as OpenMetrics text.
+ *
+ * The exposition is rendered once per window by the exporter thread (see
+ * `OpenMetricsWriter`) and handed over with `publish()`; a scrape only copies the
+ * pointer to the latest text under a mutex and writes it out, so scrapes cost nothing
+ * on the poll path and never touch the counters. The listener binds 127.0.0.1 only and
+ * answers one request per connection from its own thread:
+ *   GET /metrics   200, the latest exposition (an empty one with "# EOF" before the first)
+ *   GET <other>    404
+ *   other methods  405
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "json_writer.h"    // append_u64()
+
+constexpr char OPENMETRICS_CONTENT_TYPE[] = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+// ++ Appends OpenMetrics text: metric families, their samples and the final "# EOF"
+class OpenMetricsWriter {
+public:
+    explicit OpenMetricsWriter(std::string& out) : out_(out) {}
+
+    // `# TYPE` and `# HELP` lines of a family; `type` is "counter" or "gauge".
+    void family(const char* name, const char* type, const char* help) {
+        out_.append("# TYPE ").append(name).push_back(' ');
+        out_.append(type).push_back('\n');
+        out_.append("# HELP ").append(name).push_back(' ');
+        out_.append(help).push_back('\n');
+    }
+
+    /**
+     * @brief One sample `<name><suffix>{<labels>} <value>`; `labels` is a comma separated
+     *        list of `key="value"` pairs, empty for none.
+     */
+    void sample(const char* name, const char* suffix, std::string_view labels, const uint64_t value) {
+        out_.append(name).append(suffix);
+        if (!labels.empty()) {
+            out_.push_back('{');
+            out_.append(labels);
+            out_.push_back('}');
+        }
+        out_.push_back(' ');
+        append_u64(out_, value);
+        out_.push_back('\n');
+    }
+
+    void eof() { out_.append("# EOF\n"); }
+
+private:
+    std::string& out_;
+};
+
+class MetricsServer {
+public:
+    MetricsServer() : text_(std::make_shared<const std::string>("# EOF\n")) {}
+    ~MetricsServer() { stop(); }
+
+    /**
+     * @brief Listen on 127.0.0.1:`port` (0 picks a free port, see `port()`) and start
+     *        the serving thread.
+     *
+     * @return int  0 on success, or -1 with errno set.
+     */
+    int start(const uint16_t port) {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0)
+            return -1;
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        socklen_t len = sizeof(addr);
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(listen_fd_, 16) != 0
+            || getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+            int err = errno;
+            ::close(listen_fd_);
+            listen_fd_ = -1;
+            errno = err;
+            return -1;
+        }
+        port_ = ntohs(addr.sin_port);
+        stop_ = false;
+        thread_ = std::thread([this]() { serve(); });
+        return 0;
+    }
+
+    bool running() const { return listen_fd_ >= 0; }
+    uint16_t port() const { return port_; }
+
+    // Scrapes served so far.
+    uint64_t scrapes() const { return scrapes_.load(std::memory_order_relaxed); }
+
+    // Serve `text` from now on.
+    void publish(std::string text) {
+        auto next = std::make_shared<const std::string>(std::move(text));
+        std::lock_guard<std::mutex> lock(mutex_);
+        text_.swap(next);
+    }
+
+    void stop() {
+        if (listen_fd_ < 0)
+            return;
+        stop_ = true;
+        thread_.join();
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+    }
+
+private:
+    static constexpr int POLL_MS = 200;             // how often the thread checks `stop_`
+    static constexpr size_t MAX_REQUEST = 8192;
+
+    void serve() {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        while (!stop_) {
+            if (poll(&pfd, 1, POLL_MS) <= 0)
+                continue;
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+                continue;
+            // A client that stalls must not hold the only serving thread for long.
+            timeval tv{1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            handle(fd);
+            ::close(fd);
+        }
+    }
+
+    void handle(const int fd) {
+        std::string req;
+        char buf[1024];
+        while (req.find("\r\n\r\n") == std::string::npos && req.size() < MAX_REQUEST) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+                return;
+            req.append(buf, static_cast<size_t>(n));
+        }
+
+        // Request line: <method> <target> HTTP/1.x
+        const size_t sp1 = req.find(' ');
+        const size_t sp2 = sp1 == std::string::npos ? sp1 : req.find(' ', sp1 + 1);
+        if (sp2 == std::string::npos) {
+            respond(fd, "400 Bad Request", "text/plain", "bad request\n", true);
+            return;
+        }
+        const std::string_view method(req.data(), sp1);
+        std::string_view target(req.data() + sp1 + 1, sp2 - sp1 - 1);
+        target = target.substr(0, target.find('?'));
+        const bool head = method == "HEAD";
+        if (method != "GET" && !head) {
+            respond(fd, "405 Method Not Allowed", "text/plain", "method not allowed\n", !head);
+        } else if (target != "/metrics") {
+            respond(fd, "404 Not Found", "text/plain", "not found\n", !head);
+        } else {
+            std::shared_ptr<const std::string> text;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                text = text_;
+            }
+            respond(fd, "200 OK", OPENMETRICS_CONTENT_TYPE, *text, !head);
+            scrapes_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    static void respond(const int fd, const char* status, const char* type,
+        const std::string& body, const bool with_body) {
+        std::string head = "HTTP/1.1 ";
+        head.append(status).append("\r\nContent-Type: ").append(type);
+        head.append("\r\nContent-Length: ");
+        append_u64(head, body.size());
+        head.append("\r\nConnection: close\r\n\r\n");
+        if (send_all(fd, head.data(), head.size()) && with_body)
+            send_all(fd, body.data(), body.size());
+    }
+
+    static bool send_all(const int fd, const char* p, size_t n) {
+        while (n > 0) {
+            ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            p += w;
+            n -= static_cast<size_t>(w);
+        }
+        return true;
+    }
+
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> scrapes_{0};
+    std::thread thread_;
+    std::mutex mutex_;                          // guards the `text_` pointer only
+    std::shared_ptr<const std::string> text_;   // latest exposition
+};
+
+#endif
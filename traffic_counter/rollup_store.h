@@ -0,0 +1,193 @@
+/**
+ * Fixed-size rollup tiers of the collector's per-tick deltas.
+ *
+ * A `RollupTier` keeps, per key and metric, the sum, max and min of the tick deltas of
+ * every period (1 s, 1 min, ...) in a ring of `slots` periods. The tiers are fed
+ * incrementally: the 1 s tier from each exported window's deltas, the 1 min tier from the
+ * same per-second aggregate, so long-term queries never read raw bins. Max and min are
+ * always those of single ticks, at every tier.
+ *
+ * Ticks with a zero delta are idle: `min` is the smallest non-zero tick delta of the
+ * period, whether the idle ticks fall inside a second with traffic or fill a whole idle
+ * second (which never reaches the tiers). A metric without traffic in a period is empty.
+ *
+ * A key's series is dropped by `expire()` once its newest period has left the ring, so the
+ * memory follows the keys with traffic within the last `slots` periods.
+ *
+ * `add()` and `expire()` are called by the exporter thread; `query()` and `for_each_key()`
+ * may be used from any thread.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef ROLLUP_STORE_H
+#define ROLLUP_STORE_H
+
+#include <linux/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "window_store.h"
+
+// ++ Aggregate of the tick deltas of one period
+struct RollupCell {
+    __u64 sum = 0;
+    __u64 max = 0;
+    __u64 min = std::numeric_limits<__u64>::max();
+
+    bool empty() const { return min == std::numeric_limits<__u64>::max(); }
+
+    // Zero deltas are idle ticks and change nothing, see the file comment.
+    void add(const __u64 delta) {
+        if (delta == 0)
+            return;
+        sum += delta;
+        max = std::max(max, delta);
+        min = std::min(min, delta);
+    }
+
+    void merge(const RollupCell& o) {
+        sum += o.sum;
+        max = std::max(max, o.max);
+        min = std::min(min, o.min);
+    }
+};
+
+using RollupCells = std::array<RollupCell, NUM_WINDOW_METRICS>;
+
+// ++ One period of a key, as returned by `RollupTier::query()`
+struct RollupPoint {
+    time_t start;
+    RollupCell cell;
+};
+
+template <typename Key>
+class RollupTier {
+public:
+    /**
+     * @brief Set the period length and the number of periods kept per key; 0 slots
+     *        disables the tier. Drops all data.
+     */
+    void init(const time_t period_sec, const size_t slots) {
+        std::unique_lock lock(mutex_);
+        period_ = period_sec;
+        slots_ = slots;
+        expired_ = -1;
+        series_.clear();
+    }
+
+    bool enabled() const { return slots_ > 0; }
+    time_t period() const { return period_; }
+
+    // Start of the period holding `second`.
+    time_t period_of(const time_t second) const { return second - second % period_; }
+
+    /**
+     * @brief Merge `cells` (one per metric) of `key` into the period holding `second`.
+     *        Reuses the slot of a period `slots` periods older.
+     */
+    void add(const Key& key, const time_t second, const RollupCells& cells) {
+        if (!enabled())
+            return;
+        const time_t start = period_of(second);
+        std::unique_lock lock(mutex_);
+        Series& s = series_[key];
+        if (s.start.empty()) {
+            s.start.assign(slots_, -1);
+            s.cells.resize(slots_);
+        }
+        s.newest = std::max(s.newest, start);
+        const size_t slot = static_cast<size_t>(start / period_) % slots_;
+        if (s.start[slot] != start) {
+            s.start[slot] = start;
+            s.cells[slot] = RollupCells{};
+        }
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            s.cells[slot][m].merge(cells[m]);
+    }
+
+    /**
+     * @brief Drop the series of the keys without traffic in the `slots` periods up to the
+     *        one holding `second`. Sweeps once per period.
+     */
+    void expire(const time_t second) {
+        if (!enabled())
+            return;
+        const time_t start = period_of(second);
+        if (start == expired_)
+            return;
+        const time_t oldest_kept = start - static_cast<time_t>(slots_ - 1) * period_;
+        std::unique_lock lock(mutex_);
+        for (auto it = series_.begin(); it != series_.end();) {
+            if (it->second.newest < oldest_kept)
+                it = series_.erase(it);
+            else
+                ++it;
+        }
+        expired_ = start;
+    }
+
+    size_t size() const {
+        std::shared_lock lock(mutex_);
+        return series_.size();
+    }
+
+    /**
+     * @brief Periods of `key` and metric `m` starting in [from, to], oldest first.
+     */
+    std::vector<RollupPoint> query(const Key& key, const WindowMetric m, const time_t from, const time_t to) const {
+        std::vector<RollupPoint> out;
+        std::shared_lock lock(mutex_);
+        auto it = series_.find(key);
+        if (it == series_.end())
+            return out;
+        const Series& s = it->second;
+        for (size_t i = 0; i < slots_; ++i) {
+            if (s.start[i] >= 0 && s.start[i] >= from && s.start[i] <= to && !s.cells[i][m].empty())
+                out.push_back(RollupPoint{s.start[i], s.cells[i][m]});
+        }
+        std::sort(out.begin(), out.end(),
+                  [](const RollupPoint& a, const RollupPoint& b) { return a.start < b.start; });
+        return out;
+    }
+
+    /**
+     * @brief Call `fn(key, cells)` for every key with data in the period starting at `start`.
+     */
+    template <typename Fn>
+    void for_each_key(const time_t start, Fn fn) const {
+        if (!enabled())
+            return;
+        std::shared_lock lock(mutex_);
+        const size_t slot = static_cast<size_t>(start / period_) % slots_;
+        for (const auto& [key, s] : series_) {
+            if (s.start[slot] == start)
+                fn(key, s.cells[slot]);
+        }
+    }
+
+private:
+    struct Series {
+        std::vector<time_t> start;          // period start by slot, -1 if never used
+        std::vector<RollupCells> cells;     // aggregates by slot
+        time_t newest = -1;                 // start of the newest period with data
+    };
+
+    time_t period_ = 1;
+    size_t slots_ = 0;
+    time_t expired_ = -1;   // period of the last `expire()` sweep
+    mutable std::shared_mutex mutex_;
+    std::map<Key, Series> series_;
+};
+
+#endif
@@ -0,0 +1,435 @@
+/**
+ * Shared-memory ring of the collector's exported windows, for local readers.
+ *
+ * The collector (`--shm-ring <name>`) publishes every exported window into the POSIX
+ * shared memory object `/dev/shm/<name>`. Readers map it read-only and read the latest
+ * windows in place, without copies and without any lock: the writer never waits for
+ * them, and a reader detects afterwards whether the writer overwrote what it read.
+ *
+ * Layout, all offsets from the start of the mapping, native byte order:
+ *   ShmRingHeader          magic, geometry, header seqlock, window count, `write_end`
+ *   ShmIndexEntry[slots]   second, data offset and length of the last `slots` windows
+ *   data[capacity]         window records, 8-byte aligned, never wrapping around:
+ *     ShmWindowHeader      second, ticks, rows
+ *     u64 tick_ns[ticks]   CLOCK_MONOTONIC sampling time of every tick
+ *     ShmRow[rows]         key (as in tc_binary.h) and valid length of every metric
+ *     u64 deltas[rows][4][ticks]
+ *
+ * Records are addressed by a monotonic byte offset, stored at `offset % capacity`.
+ * Publishing a window:
+ *   1. `write_end` = end offset of the new record (release fence), then the record is
+ *      written: every byte below `write_end - capacity` may now be garbage;
+ *   2. the index entry and the window count are updated under the header seqlock.
+ * Reading: snapshot the index under the seqlock (retrying while the writer is in it),
+ * read the records in place, then check `ShmRingReader::valid()`: the record is intact
+ * if `write_end` has not passed its offset + capacity.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <linux/types.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "window_store.h"
+#include "delta_kernel.h"
+#include "tc_binary.h"
+
+constexpr char SHM_RING_MAGIC[8] = {'T', 'C', 'S', 'H', 'M', 'R', 'N', 'G'};
+constexpr uint32_t SHM_RING_VERSION = 1;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs address-free 64-bit atomics");
+
+struct ShmIndexEntry {
+    std::atomic<int64_t> second;
+    std::atomic<uint64_t> offset;   // monotonic data offset of the record
+    std::atomic<uint64_t> len;
+};
+
+struct ShmRingHeader {
+    char magic[8];                  // written last by the creator
+    uint32_t version;
+    uint32_t index_slots;
+    uint64_t capacity;              // bytes of the data area
+    uint64_t data_start;            // offset of the data area in the mapping
+    uint32_t poll_hz;               // ticks per window, as in the binary export header
+    uint32_t reserved;
+
+    alignas(64) std::atomic<uint64_t> seq;          // seqlock of `published` and the index
+    std::atomic<uint64_t> published;                // windows published so far
+    alignas(64) std::atomic<uint64_t> write_end;    // end offset of the record being written
+};
+
+struct ShmWindowHeader {
+    int64_t second;
+    uint32_t ticks;
+    uint32_t rows;
+};
+
+struct ShmRow {
+    uint8_t key_type;               // TC_KEY_*
+    uint8_t reserved[3];
+    uint32_t valid_len[NUM_WINDOW_METRICS];
+    uint8_t key[16];
+    uint32_t reserved2;
+};
+
+static_assert(sizeof(ShmWindowHeader) % 8 == 0 && sizeof(ShmRow) % 8 == 0, "records must stay 8-byte aligned");
+
+inline size_t shm_record_len(const size_t ticks, const size_t rows) {
+    return sizeof(ShmWindowHeader) + ticks * 8 + rows * sizeof(ShmRow) + rows * NUM_WINDOW_METRICS * ticks * 8;
+}
+
+// Size of the shared memory object of a ring.
+inline size_t shm_ring_size(const size_t index_slots, const size_t capacity) {
+    const size_t data_start = (sizeof(ShmRingHeader) + index_slots * sizeof(ShmIndexEntry) + 63) / 64 * 64;
+    return data_start + capacity;
+}
+
+class ShmRingWriter {
+public:
+    ~ShmRingWriter() { close(); }
+
+    /**
+     * @brief Create (or replace) the shared memory object `name` with a data area of
+     *        `capacity` bytes and an index of the last `index_slots` windows.
+     *
+     * @return int  0 on success, or -1 with errno set.
+     */
+    int create(const std::string& name, const size_t capacity, const size_t index_slots,
+        const uint32_t poll_hz) {
+        if (index_slots == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        name_ = name;
+        // A new object: readers still attached to an old one keep it intact.
+        shm_unlink(("/" + name).c_str());
+        int fd = shm_open(("/" + name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+            return -1;
+        const size_t data_bytes = capacity / 8 * 8;     // keeps every record 8-byte aligned
+        size_ = shm_ring_size(index_slots, data_bytes);
+        if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return -1;
+        }
+        void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return -1;
+        base_ = static_cast<uint8_t*>(p);
+
+        hdr_ = new (base_) ShmRingHeader();
+        hdr_->version = SHM_RING_VERSION;
+        hdr_->index_slots = static_cast<uint32_t>(index_slots);
+        hdr_->capacity = data_bytes;
+        hdr_->data_start = shm_ring_size(index_slots, 0);
+        hdr_->poll_hz = poll_hz;
+        index_ = reinterpret_cast<ShmIndexEntry*>(base_ + sizeof(ShmRingHeader));
+        for (size_t i = 0; i < index_slots; ++i)
+            new (&index_[i]) ShmIndexEntry{{0}, {0}, {0}};
+        data_ = base_ + hdr_->data_start;
+        cursor_ = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(hdr_->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC));
+        return 0;
+    }
+
+    bool is_open() const { return base_ != nullptr; }
+
+    // Windows too large for the data area, left out.
+    uint64_t oversized() const { return oversized_; }
+
+    /**
+     * @brief Start the window of `second`; copies the tick times.
+     */
+    void begin_window(const time_t second, const __u64* tick_ns, const size_t ticks) {
+        second_ = second;
+        tick_ns_.assign(tick_ns, tick_ns + ticks);
+        rows_.clear();
+    }
+
+    /**
+     * @brief Add row `r` of `deltas` under `key`; rows without any valid delta are left
+     *        out. `deltas` must stay untouched until `end_window()`.
+     */
+    void add_row(const BinaryKey& key, const DeltaWindow& deltas, const size_t r) {
+        bool has_deltas = false;
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            has_deltas |= deltas.valid_len(r, static_cast<WindowMetric>(m)) > 0;
+        if (has_deltas)
+            rows_.push_back(Row{key, &deltas, r});
+    }
+
+    /**
+     * @brief Write the window into the ring and publish it. Never waits for readers.
+     *
+     * @return bool  false if the window does not fit in the data area (left out).
+     */
+    bool end_window() {
+        const size_t ticks = tick_ns_.size();
+        const size_t len = shm_record_len(ticks, rows_.size());
+        const uint64_t capacity = hdr_->capacity;
+        if (len > capacity) {
+            oversized_ += 1;
+            return false;
+        }
+        uint64_t offset = cursor_;
+        if (offset % capacity + len > capacity)
+            offset += capacity - offset % capacity;     // start the next lap
+        cursor_ = offset + len;
+
+        // 1. Invalidate what the record overwrites, then write it.
+        hdr_->write_end.store(cursor_, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write_record(data_ + offset % capacity, ticks);
+
+        // 2. Publish it.
+        const uint64_t seq = hdr_->seq.load(std::memory_order_relaxed);
+        hdr_->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        const uint64_t n = hdr_->published.load(std::memory_order_relaxed);
+        ShmIndexEntry& e = index_[n % hdr_->index_slots];
+        e.second.store(second_, std::memory_order_relaxed);
+        e.offset.store(offset, std::memory_order_relaxed);
+        e.len.store(len, std::memory_order_relaxed);
+        hdr_->published.store(n + 1, std::memory_order_relaxed);
+        hdr_->seq.store(seq + 2, std::memory_order_release);
+        return true;
+    }
+
+    // Unmap and remove the shared memory object; attached readers keep their mapping.
+    void close() {
+        if (!base_)
+            return;
+        munmap(base_, size_);
+        shm_unlink(("/" + name_).c_str());
+        base_ = nullptr;
+    }
+
+private:
+    struct Row {
+        BinaryKey key;
+        const DeltaWindow* deltas;
+        size_t r;
+    };
+
+    void write_record(uint8_t* p, const size_t ticks) {
+        ShmWindowHeader h{static_cast<int64_t>(second_), static_cast<uint32_t>(ticks),
+                          static_cast<uint32_t>(rows_.size())};
+        std::memcpy(p, &h, sizeof(h));
+        p += sizeof(h);
+        std::memcpy(p, tick_ns_.data(), ticks * 8);
+        p += ticks * 8;
+        for (const Row& row : rows_) {
+            ShmRow sr{};
+            sr.key_type = row.key.type;
+            std::memcpy(sr.key, row.key.bytes, sizeof(sr.key));
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+                sr.valid_len[m] = row.deltas->valid_len(row.r, static_cast<WindowMetric>(m));
+            std::memcpy(p, &sr, sizeof(sr));
+            p += sizeof(sr);
+        }
+        for (const Row& row : rows_) {
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                const WindowMetric metric = static_cast<WindowMetric>(m);
+                const size_t valid = row.deltas->valid_len(row.r, metric);
+                std::memcpy(p, row.deltas->row(row.r, metric), valid * 8);
+                std::memset(p + valid * 8, 0, (ticks - valid) * 8);
+                p += ticks * 8;
+            }
+        }
+    }
+
+    std::string name_;
+    uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    ShmRingHeader* hdr_ = nullptr;
+    ShmIndexEntry* index_ = nullptr;
+    uint8_t* data_ = nullptr;
+    uint64_t cursor_ = 0;           // monotonic end of the last record
+    uint64_t oversized_ = 0;
+    time_t second_ = 0;
+    std::vector<__u64> tick_ns_;
+    std::vector<Row> rows_;
+};
+
+// ++ One window in the ring, read in place; check `ShmRingReader::valid()` after use
+class ShmWindowView {
+public:
+    time_t second() const { return second_; }
+    size_t ticks() const { return ticks_; }
+    size_t size() const { return rows_; }
+
+    // Sampling time of every tick (CLOCK_MONOTONIC ns), `ticks()` values.
+    const __u64* tick_ns() const { return reinterpret_cast<const __u64*>(rec_ + sizeof(ShmWindowHeader)); }
+
+    uint8_t key_type(size_t r) const { return row(r).key_type; }
+    const uint8_t* key(size_t r) const { return row(r).key; }
+
+    // Number of valid deltas of a row and metric; the rest of its `ticks()` are zero.
+    uint32_t valid_len(size_t r, WindowMetric m) const { return row(r).valid_len[m]; }
+    const __u64* deltas(size_t r, WindowMetric m) const {
+        return reinterpret_cast<const __u64*>(rec_ + deltas_start() + ((r * NUM_WINDOW_METRICS + m) * ticks_) * 8);
+    }
+
+    uint64_t offset() const { return offset_; }
+
+private:
+    friend class ShmRingReader;
+
+    const ShmRow& row(size_t r) const {
+        return *reinterpret_cast<const ShmRow*>(rec_ + sizeof(ShmWindowHeader) + ticks_ * 8 + r * sizeof(ShmRow));
+    }
+    size_t deltas_start() const { return sizeof(ShmWindowHeader) + ticks_ * 8 + rows_ * sizeof(ShmRow); }
+
+    const uint8_t* rec_ = nullptr;
+    uint64_t offset_ = 0;
+    time_t second_ = 0;
+    size_t ticks_ = 0;
+    size_t rows_ = 0;
+};
+
+class ShmRingReader {
+public:
+    ~ShmRingReader() { detach(); }
+
+    /**
+     * @brief Map the ring `name` read-only.
+     *
+     * @return int  0 on success, or -1 with errno set (EINVAL: not a ring, or not ready yet).
+     */
+    int attach(const std::string& name) {
+        int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return -1;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmRingHeader)) {
+            ::close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return -1;
+        base_ = static_cast<const uint8_t*>(p);
+        hdr_ = reinterpret_cast<const ShmRingHeader*>(base_);
+        if (std::memcmp(hdr_->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC)) != 0
+            || hdr_->version != SHM_RING_VERSION
+            || size_ < shm_ring_size(hdr_->index_slots, hdr_->capacity)) {
+            detach();
+            errno = EINVAL;
+            return -1;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        index_ = reinterpret_cast<const ShmIndexEntry*>(base_ + sizeof(ShmRingHeader));
+        data_ = base_ + hdr_->data_start;
+        return 0;
+    }
+
+    void detach() {
+        if (base_)
+            munmap(const_cast<uint8_t*>(base_), size_);
+        base_ = nullptr;
+    }
+
+    uint32_t poll_hz() const { return hdr_->poll_hz; }
+    size_t index_slots() const { return hdr_->index_slots; }
+    uint64_t published() const { return hdr_->published.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Views of the latest (up to) `n` windows still intact, oldest first.
+     *        Never blocks: retries only while the writer updates the index, and gives up
+     *        (no views) if it never leaves it, e.g. a collector killed in the middle.
+     */
+    void latest(size_t n, std::vector<ShmWindowView>& out) const {
+        out.clear();
+        n = std::min<size_t>(n, hdr_->index_slots);
+        struct Entry { int64_t second; uint64_t offset, len; };
+        std::vector<Entry> e(n);
+        uint64_t count = 0;
+        for (int attempt = 0;; ++attempt) {
+            if (attempt == MAX_INDEX_ATTEMPTS)
+                return;
+            const uint64_t s1 = hdr_->seq.load(std::memory_order_acquire);
+            if (s1 & 1)
+                continue;
+            const uint64_t last = hdr_->published.load(std::memory_order_relaxed);
+            count = std::min<uint64_t>(n, last);
+            for (uint64_t i = 0; i < count; ++i) {
+                const ShmIndexEntry& src = index_[(last - count + i) % hdr_->index_slots];
+                e[i] = Entry{src.second.load(std::memory_order_relaxed),
+                             src.offset.load(std::memory_order_relaxed),
+                             src.len.load(std::memory_order_relaxed)};
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (hdr_->seq.load(std::memory_order_relaxed) == s1)
+                break;
+        }
+
+        const uint64_t capacity = hdr_->capacity;
+        for (uint64_t i = 0; i < count; ++i) {
+            if (!intact(e[i].offset) || e[i].len < sizeof(ShmWindowHeader))
+                continue;
+            ShmWindowView v;
+            v.rec_ = data_ + e[i].offset % capacity;
+            v.offset_ = e[i].offset;
+            ShmWindowHeader h;
+            std::memcpy(&h, v.rec_, sizeof(h));
+            // A record overwritten meanwhile can have any header: keep the view in bounds.
+            if (h.second != e[i].second || shm_record_len(h.ticks, h.rows) != e[i].len)
+                continue;
+            v.second_ = h.second;
+            v.ticks_ = h.ticks;
+            v.rows_ = h.rows;
+            out.push_back(v);
+        }
+    }
+
+    /**
+     * @brief Whether everything read from `view` so far is intact, i.e. the writer has
+     *        not started to overwrite it. Call it after reading, before using the values.
+     */
+    bool valid(const ShmWindowView& view) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return intact(view.offset_);
+    }
+
+private:
+    static constexpr int MAX_INDEX_ATTEMPTS = 1 << 20;
+
+    bool intact(const uint64_t offset) const {
+        return hdr_->write_end.load(std::memory_order_relaxed) <= offset + hdr_->capacity;
+    }
+
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    const ShmRingHeader* hdr_ = nullptr;
+    const ShmIndexEntry* index_ = nullptr;
+    const uint8_t* data_ = nullptr;
+};
+
+#endif
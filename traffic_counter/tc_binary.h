@@ -0,0 +1,546 @@
+/**
+ * Binary export format of the collector's windows, with its writer and reader.
+ *
+ * A file is a 16-byte header followed by length-prefixed records. All integers are
+ * little-endian and fixed-size; nothing is padded or aligned.
+ *
+ *   File header
+ *     char magic[4]        "TCWB"
+ *     u16  version         TC_BINARY_VERSION; readers reject other versions
+ *     u16  header_len      16, the offset of the first record
+ *     u32  poll_hz         ticks per window (1 s): -p, or 1 s / -w for the "bins" backend
+ *     u32  flags           0
+ *
+ *   Record
+ *     u32  len             bytes of the record after this field
+ *     u16  type            TC_RECORD_WINDOW; readers skip other types
+ *     u16  reserved
+ *     ...  payload
+ *
+ *   TC_RECORD_WINDOW payload, one per exported second (also without traffic, so that
+ *   the tick times chain from window to window)
+ *     i64  second
+ *     u32  ticks           T
+ *     u16  num_sections
+ *     u16  reserved
+ *     u64  tick_ns[T]      CLOCK_MONOTONIC sampling time of every tick, 0 if not polled
+ *     sections, one per key type with rows:
+ *       u8   key_type      TC_KEY_*
+ *       u8   key_size      bytes per key
+ *       u16  reserved
+ *       u32  rows          R, only the rows with traffic in the window
+ *       u8   keys[R * key_size]
+ *       u32  valid_len[4][R]       per metric (tcp_bytes, tcp_packets, udp_bytes,
+ *                                  udp_packets), then per row: the deltas kept of it
+ *       u64  deltas[4][R][valid_len]  the per-tick deltas, same order, back to back
+ *
+ *   Keys
+ *     TC_KEY_IPV4  u32 address as in the JSON labels (network order read as an integer)
+ *     TC_KEY_IPV6  16 bytes, network order
+ *     TC_KEY_FLOW4 u32 saddr, u32 daddr (as TC_KEY_IPV4), u16 sport, u16 dport (host order)
+ *
+ * `BinaryWriter` stages whole records in one large buffer and writes it with `write(2)`
+ * every `flush_bytes` or `flush_windows`. A failed write keeps the records not written
+ * out for the next flush; past `max_buffer_bytes` (a full disk) the buffered windows are
+ * dropped instead, never a part of one. `BinaryReader` returns the windows of a file as
+ * `DeltaWindow`s, ready for `ReportWriter` (json_writer.h), see tc_convert.cpp; it
+ * rejects records longer than `TC_BINARY_MAX_RECORD`.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef TC_BINARY_H
+#define TC_BINARY_H
+
+#include <linux/types.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "window_store.h"
+#include "delta_kernel.h"
+#include "json_writer.h"
+
+constexpr char TC_BINARY_MAGIC[4] = {'T', 'C', 'W', 'B'};
+constexpr uint16_t TC_BINARY_VERSION = 1;
+constexpr uint16_t TC_BINARY_HEADER_LEN = 16;
+constexpr uint16_t TC_RECORD_WINDOW = 1;
+constexpr size_t TC_WINDOW_HEADER_LEN = 16;     // second, ticks, num_sections, reserved
+constexpr size_t TC_BINARY_MAX_RECORD = 1u << 30;   // longest record a reader accepts
+
+enum BinaryKeyType : uint8_t {
+    TC_KEY_IPV4 = 1,
+    TC_KEY_IPV6 = 2,
+    TC_KEY_FLOW4 = 3,
+};
+
+inline size_t binary_key_size(const uint8_t type) {
+    switch (type) {
+    case TC_KEY_IPV4:   return 4;
+    case TC_KEY_IPV6:   return 16;
+    case TC_KEY_FLOW4:  return 12;
+    default:            return 0;
+    }
+}
+
+// ++ A row key in its binary form
+struct BinaryKey {
+    uint8_t type = TC_KEY_IPV4;
+    uint8_t bytes[16] = {};
+};
+
+// ++ Little-endian encoding
+inline void le_put(uint8_t* p, uint64_t v, const size_t n) {
+    for (size_t i = 0; i < n; ++i, v >>= 8)
+        p[i] = static_cast<uint8_t>(v);
+}
+
+inline uint64_t le_get(const uint8_t* p, const size_t n) {
+    uint64_t v = 0;
+    for (size_t i = n; i > 0; --i)
+        v = (v << 8) | p[i - 1];
+    return v;
+}
+
+inline BinaryKey binary_key_ipv4(const uint32_t addr) {
+    BinaryKey k;
+    k.type = TC_KEY_IPV4;
+    le_put(k.bytes, addr, 4);
+    return k;
+}
+
+inline BinaryKey binary_key_ipv6(const Ip6Addr& addr) {
+    BinaryKey k;
+    k.type = TC_KEY_IPV6;
+    std::memcpy(k.bytes, addr.data(), 16);
+    return k;
+}
+
+inline BinaryKey binary_key_flow4(const uint32_t saddr, const uint32_t daddr,
+    const uint16_t sport, const uint16_t dport) {
+    BinaryKey k;
+    k.type = TC_KEY_FLOW4;
+    le_put(k.bytes, saddr, 4);
+    le_put(k.bytes + 4, daddr, 4);
+    le_put(k.bytes + 8, sport, 2);
+    le_put(k.bytes + 10, dport, 2);
+    return k;
+}
+
+/**
+ * @brief Append the JSON label of a binary key to `out`, the same as the collector's
+ *        `row_label()`: "<ipv4 as integer>", "<saddr>:<sport>-<daddr>:<dport>" or the
+ *        IPv6 text form.
+ */
+inline void append_binary_key_label(std::string& out, const uint8_t type, const uint8_t* key) {
+    switch (type) {
+    case TC_KEY_IPV4:
+        append_u64(out, le_get(key, 4));
+        break;
+    case TC_KEY_FLOW4:
+        append_u64(out, le_get(key, 4));
+        out.push_back(':');
+        append_u64(out, le_get(key + 8, 2));
+        out.push_back('-');
+        append_u64(out, le_get(key + 4, 4));
+        out.push_back(':');
+        append_u64(out, le_get(key + 10, 2));
+        break;
+    case TC_KEY_IPV6: {
+        char ip_str[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, key, ip_str, sizeof(ip_str));
+        out.append(ip_str);
+        break;
+    }
+    }
+}
+
+class BinaryWriter {
+public:
+    size_t flush_bytes = 4 << 20;   // write out the buffer once it holds this much
+    size_t flush_windows = 10;      // ... or this many windows
+    size_t max_buffer_bytes = 64 << 20;     // drop the buffered windows past this while writes fail
+
+    ~BinaryWriter() { close(); }
+
+    /**
+     * @brief Create (truncate) `path` and write the file header.
+     *
+     * @return int  0 on success, or -1 with errno set.
+     */
+    int open(const std::string& path, const uint32_t poll_hz) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+            return -1;
+        uint8_t* p = grow(TC_BINARY_HEADER_LEN);
+        head_ = TC_BINARY_HEADER_LEN;   // never dropped, the records follow it
+        std::memcpy(p, TC_BINARY_MAGIC, 4);
+        le_put(p + 4, TC_BINARY_VERSION, 2);
+        le_put(p + 6, TC_BINARY_HEADER_LEN, 2);
+        le_put(p + 8, poll_hz, 4);
+        le_put(p + 12, 0, 4);
+        return flush();
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    // Windows dropped because the file could not be written.
+    size_t dropped_windows() const { return dropped_windows_; }
+
+    /**
+     * @brief Start the record of the window of `second`; copies the tick times.
+     */
+    void begin_window(const time_t second, const __u64* tick_ns, const size_t ticks) {
+        record_start_ = buf_.size();
+        rows_.clear();
+        uint8_t* p = grow(8 + TC_WINDOW_HEADER_LEN);
+        le_put(p + 4, TC_RECORD_WINDOW, 2);
+        le_put(p + 6, 0, 2);
+        le_put(p + 8, static_cast<uint64_t>(second), 8);
+        le_put(p + 16, ticks, 4);
+        put_u64s(tick_ns, ticks);
+    }
+
+    /**
+     * @brief Add row `r` of `deltas` under `key`; rows without any valid delta are left
+     *        out. `deltas` must stay untouched until `end_window()`.
+     */
+    void add_row(const BinaryKey& key, const DeltaWindow& deltas, const size_t r) {
+        bool has_deltas = false;
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            has_deltas |= deltas.valid_len(r, static_cast<WindowMetric>(m)) > 0;
+        if (has_deltas)
+            rows_.push_back(Row{key, &deltas, r});
+    }
+
+    /**
+     * @brief Encode the staged rows, one section per run of rows with the same key type,
+     *        and close the record. Writes the buffer out when it is due.
+     *
+     * @return int  0 on success, or -1 with errno set if a write failed.
+     */
+    int end_window() {
+        uint16_t sections = 0;
+        for (size_t begin = 0; begin < rows_.size();) {
+            size_t end = begin;
+            while (end < rows_.size() && rows_[end].key.type == rows_[begin].key.type)
+                ++end;
+            put_section(begin, end);
+            sections += 1;
+            begin = end;
+        }
+        uint8_t* rec = buf_.data() + record_start_;
+        le_put(rec, buf_.size() - record_start_ - 4, 4);
+        le_put(rec + 8 + 12, sections, 2);
+        le_put(rec + 8 + 14, 0, 2);
+
+        if (++pending_windows_ >= flush_windows || buf_.size() >= flush_bytes)
+            return flush();
+        return 0;
+    }
+
+    /**
+     * @brief Write out the buffered records.
+     *
+     * On a failed write the bytes already written are removed from the buffer, so the next
+     * flush continues the stream where it stopped. If the rest exceeds `max_buffer_bytes`,
+     * every buffered window is dropped except the unwritten tail of a record already begun
+     * in the file.
+     *
+     * @return int  0 on success, or -1 with errno set.
+     */
+    int flush() {
+        size_t done = 0;
+        while (done < buf_.size()) {
+            ssize_t n = ::write(fd_, buf_.data() + done, buf_.size() - done);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                const int err = errno;
+                keep_unwritten(done);
+                errno = err;
+                return -1;
+            }
+            done += static_cast<size_t>(n);
+        }
+        buf_.clear();
+        head_ = 0;
+        pending_windows_ = 0;
+        return 0;
+    }
+
+    void close() {
+        if (fd_ < 0)
+            return;
+        flush();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+private:
+    struct Row {
+        BinaryKey key;
+        const DeltaWindow* deltas;
+        size_t r;
+    };
+
+    // Remove the first `done` (written) bytes of `buf_`; drop the whole records if the rest is too large.
+    void keep_unwritten(const size_t done) {
+        if (done <= head_) {
+            head_ -= done;
+        } else {
+            // Walk the records begun in the file: the tail of the last one is the new head.
+            size_t pos = head_;
+            while (pos < done) {
+                pos += 4 + le_get(buf_.data() + pos, 4);
+                pending_windows_ -= 1;
+            }
+            head_ = pos - done;
+        }
+        buf_.erase(buf_.begin(), buf_.begin() + static_cast<std::ptrdiff_t>(done));
+        if (buf_.size() > max_buffer_bytes) {
+            dropped_windows_ += pending_windows_;
+            buf_.resize(head_);
+            pending_windows_ = 0;
+        }
+    }
+
+    uint8_t* grow(const size_t n) {
+        const size_t start = buf_.size();
+        buf_.resize(start + n);
+        return buf_.data() + start;
+    }
+
+    void put_u64s(const __u64* v, const size_t n) {
+        uint8_t* p = grow(n * 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(p, v, n * 8);
+#else
+        for (size_t i = 0; i < n; ++i)
+            le_put(p + i * 8, v[i], 8);
+#endif
+    }
+
+    void put_section(const size_t begin, const size_t end) {
+        const uint8_t type = rows_[begin].key.type;
+        const size_t key_size = binary_key_size(type);
+        const size_t rows = end - begin;
+        uint8_t* p = grow(8 + rows * key_size + rows * NUM_WINDOW_METRICS * 4);
+        p[0] = type;
+        p[1] = static_cast<uint8_t>(key_size);
+        le_put(p + 2, 0, 2);
+        le_put(p + 4, rows, 4);
+        p += 8;
+        for (size_t i = begin; i < end; ++i, p += key_size)
+            std::memcpy(p, rows_[i].key.bytes, key_size);
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            for (size_t i = begin; i < end; ++i, p += 4)
+                le_put(p, rows_[i].deltas->valid_len(rows_[i].r, static_cast<WindowMetric>(m)), 4);
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            const WindowMetric metric = static_cast<WindowMetric>(m);
+            for (size_t i = begin; i < end; ++i) {
+                const Row& row = rows_[i];
+                put_u64s(row.deltas->row(row.r, metric), row.deltas->valid_len(row.r, metric));
+            }
+        }
+    }
+
+    int fd_ = -1;
+    std::vector<uint8_t> buf_;      // records not written out yet
+    size_t head_ = 0;               // leading bytes of `buf_` that are not whole records: the
+                                    // file header, or the tail of a partly written record
+    size_t pending_windows_ = 0;    // whole records in `buf_` after the head
+    size_t dropped_windows_ = 0;
+    size_t record_start_ = 0;       // offset of the open record in `buf_`
+    std::vector<Row> rows_;         // staged rows of the open record
+};
+
+// ++ One section of a window read back: the rows of one key type
+struct BinarySection {
+    uint8_t key_type = 0;
+    uint8_t key_size = 0;
+    std::vector<uint8_t> keys;      // rows x key_size
+    DeltaWindow deltas;             // rows x ticks, with the valid lengths
+
+    size_t size() const { return deltas.size(); }
+    const uint8_t* key(size_t r) const { return keys.data() + r * key_size; }
+};
+
+// ++ One window read back
+struct BinaryWindow {
+    time_t second = 0;
+    std::vector<__u64> tick_ns;
+    std::vector<BinarySection> sections;
+    size_t num_sections = 0;        // valid entries of `sections`, which is reused
+};
+
+class BinaryReader {
+public:
+    /**
+     * @brief Open `path` and check its header.
+     *
+     * @return bool  false if the file cannot be read or is not a supported version,
+     *               see `error()`.
+     */
+    bool open(const std::string& path) {
+        in_.open(path, std::ios::binary);
+        if (!in_) {
+            error_ = "cannot open " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        uint8_t h[TC_BINARY_HEADER_LEN];
+        if (!in_.read(reinterpret_cast<char*>(h), sizeof(h)) || std::memcmp(h, TC_BINARY_MAGIC, 4) != 0) {
+            error_ = path + " is not a traffic counter binary export";
+            return false;
+        }
+        version_ = static_cast<uint16_t>(le_get(h + 4, 2));
+        if (version_ != TC_BINARY_VERSION) {
+            error_ = "unsupported format version " + std::to_string(version_);
+            return false;
+        }
+        const size_t header_len = le_get(h + 6, 2);
+        poll_hz_ = static_cast<uint32_t>(le_get(h + 8, 4));
+        if (header_len < TC_BINARY_HEADER_LEN || !in_.seekg(static_cast<std::streamoff>(header_len))) {
+            error_ = "bad header length";
+            return false;
+        }
+        return true;
+    }
+
+    uint16_t version() const { return version_; }
+    uint32_t poll_hz() const { return poll_hz_; }
+
+    // Why `open()` or `next()` failed; empty at the end of a well-formed file.
+    const std::string& error() const { return error_; }
+
+    /**
+     * @brief Read the next window into `w`, skipping records of unknown types.
+     *
+     * @return bool  false at the end of the file or on a truncated or malformed record.
+     */
+    bool next(BinaryWindow& w) {
+        for (;;) {
+            uint8_t len_buf[4];
+            if (!in_.read(reinterpret_cast<char*>(len_buf), 4)) {
+                if (in_.gcount() != 0)
+                    error_ = "truncated record length";
+                return false;
+            }
+            const size_t len = le_get(len_buf, 4);
+            if (len > TC_BINARY_MAX_RECORD) {
+                error_ = "record length " + std::to_string(len) + " exceeds the limit";
+                return false;
+            }
+            rec_.resize(len);
+            if (!in_.read(reinterpret_cast<char*>(rec_.data()), static_cast<std::streamsize>(rec_.size()))) {
+                error_ = "truncated record";
+                return false;
+            }
+            if (rec_.size() < 4) {
+                error_ = "record too short";
+                return false;
+            }
+            if (le_get(rec_.data(), 2) != TC_RECORD_WINDOW)
+                continue;
+            if (!parse_window(w)) {
+                error_ = "malformed window record";
+                return false;
+            }
+            return true;
+        }
+    }
+
+private:
+    // Bounds-checked cursor over the current record.
+    struct Cursor {
+        const uint8_t* p;
+        const uint8_t* end;
+
+        bool has(size_t n) const { return static_cast<size_t>(end - p) >= n; }
+        uint64_t get(size_t n) {
+            uint64_t v = le_get(p, n);
+            p += n;
+            return v;
+        }
+        void get_u64s(__u64* out, size_t n) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            std::memcpy(out, p, n * 8);
+#else
+            for (size_t i = 0; i < n; ++i)
+                out[i] = le_get(p + i * 8, 8);
+#endif
+            p += n * 8;
+        }
+    };
+
+    bool parse_window(BinaryWindow& w) {
+        Cursor c{rec_.data() + 4, rec_.data() + rec_.size()};
+        if (!c.has(TC_WINDOW_HEADER_LEN))
+            return false;
+        w.second = static_cast<time_t>(static_cast<int64_t>(c.get(8)));
+        const size_t ticks = c.get(4);
+        w.num_sections = c.get(2);
+        c.get(2);
+        if (ticks > static_cast<size_t>(c.end - c.p) / 8)
+            return false;
+        w.tick_ns.resize(ticks);
+        c.get_u64s(w.tick_ns.data(), ticks);
+
+        if (w.sections.size() < w.num_sections)
+            w.sections.resize(w.num_sections);
+        for (size_t s = 0; s < w.num_sections; ++s) {
+            BinarySection& sec = w.sections[s];
+            if (!c.has(8))
+                return false;
+            sec.key_type = static_cast<uint8_t>(c.get(1));
+            sec.key_size = static_cast<uint8_t>(c.get(1));
+            c.get(2);
+            const size_t rows = c.get(4);
+            if (sec.key_size != binary_key_size(sec.key_type)
+                || rows > static_cast<size_t>(c.end - c.p) / (sec.key_size + NUM_WINDOW_METRICS * 4))
+                return false;
+            sec.keys.assign(c.p, c.p + rows * sec.key_size);
+            c.p += rows * sec.key_size;
+            sec.deltas.resize(rows, ticks);
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                for (size_t r = 0; r < rows; ++r) {
+                    const WindowMetric metric = static_cast<WindowMetric>(m);
+                    sec.deltas.valid_len(r, metric) = static_cast<uint32_t>(c.get(4));
+                    sec.deltas.reset(r, metric) = 0;
+                    if (sec.deltas.valid_len(r, metric) > ticks)
+                        return false;
+                }
+            }
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                const WindowMetric metric = static_cast<WindowMetric>(m);
+                for (size_t r = 0; r < rows; ++r) {
+                    const size_t len = sec.deltas.valid_len(r, metric);
+                    if (!c.has(len * 8))
+                        return false;
+                    c.get_u64s(sec.deltas.row(r, metric), len);
+                }
+            }
+        }
+        return c.p == c.end;
+    }
+
+    std::ifstream in_;
+    std::vector<uint8_t> rec_;      // current record, after its length
+    std::string error_;
+    uint16_t version_ = 0;
+    uint32_t poll_hz_ = 0;
+};
+
+#endif
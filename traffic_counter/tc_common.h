@@ -21,9 +21,82 @@ struct traffic_key_t {
     __u8 pad[3];  // padding for alignment
 };
 
+// Kernel programs built with -DTC_FLOW_KEYS count per flow with this key instead.
+struct traffic_flow_key_t {
+    __u32 saddr;  // network order
+    __u32 daddr;  // network order
+    __u16 sport;  // network order; 0 for non-first IP fragments
+    __u16 dport;  // network order; 0 for non-first IP fragments
+    __u8 proto;
+    __u8 pad[3];  // padding for alignment
+};
+
+// IPv6 key of kernel programs built with -DTC_IPV6, in a separate <map>6 hash map so that
+// the IPv4 map keeps its 8-byte key.
+struct traffic_key6_t {
+    __u8 ip6[16];  // network order
+    __u8 proto;
+    __u8 pad[3];   // padding for alignment
+};
+
 struct traffic_val_t {
     __u64 packets;
     __u64 bytes;
+    // bpf_ktime_get_ns() when the kernel created the entry, 0 if not tracked (mmap slots).
+    // A new value for the same key means the LRU evicted the key and re-inserted it with
+    // zeroed counters. Only the creating CPU's copy is set in per-CPU maps.
+    __u64 created_ns;
+};
+
+// Kernel programs built with -DTC_MMAP_COUNTERS keep the counters in a BPF_F_MMAPABLE array.
+// The `packets` field of this slot holds the number of slots handed out so far;
+// per-key counters start at slot 1.
+#define TC_MMAP_HDR_SLOT 0
+
+// Kernel programs built with -DTC_TIME_BINS bucket the counters of every key into a ring of
+// sub-second bins instead of one cumulative value. A packet at ktime `t` goes to bin
+// (t / bin_width) % TC_NUM_BINS, whose `tag` is the low 32 bits of t / bin_width.
+// The ring must span at least 2 seconds so the collector can drain one full second at 1 Hz.
+#define TC_NUM_BINS 4096  // power of 2
+#define TC_DEFAULT_BIN_WIDTH_NS 500000ULL  // 0.5 ms, 2.048 s ring
+
+struct traffic_bin_t {
+    __u32 tag;
+    __u32 packets;
+    __u64 bytes;
+};
+
+struct traffic_bins_t {
+    struct traffic_bin_t bins[TC_NUM_BINS];
+};
+
+// Single entry of the <map>_cfg array, written by the collector.
+struct traffic_bin_cfg_t {
+    __u64 bin_width_ns;  // 0 means TC_DEFAULT_BIN_WIDTH_NS
+};
+
+// Kernel programs built with -DTC_RINGBUF emit a summary record of a key to the <map>_rb
+// ring buffer every `emit_every_packets` packets or `emit_every_ns` nanoseconds of that key.
+#define TC_RB_DEFAULT_EVERY_NS 1000000ULL  // 1 ms
+#define TC_RB_DEFAULT_EVERY_PACKETS 1024
+
+struct traffic_event_t {
+    struct traffic_key_t key;
+    struct traffic_val_t val;  // cumulative counters of the key
+    __u64 ts_ns;               // bpf_ktime_get_ns() at emission
+};
+
+// Single entry of the <map>_cfg array, written by the collector. 0 means the default.
+struct traffic_rb_cfg_t {
+    __u64 emit_every_ns;
+    __u64 emit_every_packets;
+};
+
+// Per-key state of the ring-buffer mode: cumulative counters plus the last emission.
+struct traffic_rb_state_t {
+    struct traffic_val_t val;
+    __u64 last_emit_ns;
+    __u64 last_emit_packets;
 };
 
 #endif
@@ -0,0 +1,107 @@
+/**
+ * Convert a binary export of the collector (`--binary-out`, see tc_binary.h) back into
+ * the JSON lines it would have printed on stdout, one record per second with traffic.
+ *
+ * The export mode and bin encoding are picked at conversion time; the output is the
+ * same as that of a collector run with the same `--export-mode` and `--bin-encoding`.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 tc_convert.cpp -o tc_convert
+ * Run:
+ *   ./tc_convert [--export-mode deltas|rates|timestamps] [--bin-encoding dense|sparse|rle] <file>
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "window_store.h"
+#include "json_writer.h"
+#include "tc_binary.h"
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--export-mode deltas|rates|timestamps]"
+              << " [--bin-encoding dense|sparse|rle] <file>" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string export_mode = "deltas";
+    std::string bin_encoding = "dense";
+    std::string path;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--export-mode" && i + 1 < argc) {
+            export_mode = argv[++i];
+            if (export_mode != "deltas" && export_mode != "rates" && export_mode != "timestamps") {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--bin-encoding" && i + 1 < argc) {
+            bin_encoding = argv[++i];
+            if (bin_encoding != "dense" && bin_encoding != "sparse" && bin_encoding != "rle") {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (path.empty() && arg[0] != '-') {
+            path = arg;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (path.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    BinaryReader reader;
+    if (!reader.open(path)) {
+        std::cerr << "tc_convert: " << reader.error() << std::endl;
+        return 1;
+    }
+
+    static char out_buf[1 << 20];
+    std::setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    ReportWriter report;
+    report.set_encoding(bin_encoding == "sparse" ? BIN_SPARSE :
+                        bin_encoding == "rle" ? BIN_RLE : BIN_DENSE);
+    BinaryWindow w;
+    __u64 last_tick_ns = 0;     // chains the tick durations of "rates" like the collector
+    std::vector<double> tick_dt_s;
+    while (reader.next(w)) {
+        if (export_mode == "rates")
+            tick_dt_s = tick_durations(w.tick_ns.data(), w.tick_ns.size(), last_tick_ns,
+                                       1.0 / reader.poll_hz());
+        last_tick_ns = last_tick_of(w.tick_ns.data(), w.tick_ns.size(), last_tick_ns);
+
+        report.clear();
+        for (size_t s = 0; s < w.num_sections; ++s) {
+            const BinarySection& sec = w.sections[s];
+            for (size_t r = 0; r < sec.size(); ++r) {
+                append_binary_key_label(report.label_buf(), sec.key_type, sec.key(r));
+                report.add_row(sec.deltas, r);
+            }
+        }
+        if (report.empty())
+            continue;
+
+        const bool timestamps = export_mode == "timestamps";
+        const std::string& text = report.write(w.second,
+            export_mode == "rates" ? tick_dt_s.data() : nullptr,
+            timestamps ? w.tick_ns.data() : nullptr, timestamps ? w.tick_ns.size() : 0);
+        std::fwrite(text.data(), 1, text.size(), stdout);
+        std::fputc('\n', stdout);
+    }
+    std::fflush(stdout);
+
+    if (!reader.error().empty()) {
+        std::cerr << "tc_convert: " << path << ": " << reader.error() << std::endl;
+        return 1;
+    }
+    return 0;
+}
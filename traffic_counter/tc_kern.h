@@ -0,0 +1,528 @@
+/**
+ * Helpers shared by the TC/XDP kernel programs only. Not for userspace.
+ *
+ * Build-time options (pass with -D, see compile_kernel.sh):
+ *   TC_PERCPU_MAP      Use BPF_MAP_TYPE_LRU_PERCPU_HASH so that every RX/TX core updates
+ *                      its own copy of the counters. The collector sums the per-CPU values.
+ *   TC_MMAP_COUNTERS   Resolve each key to a dense slot through a small index hash and keep
+ *                      the counters in a BPF_F_MMAPABLE array the collector reads with plain
+ *                      loads. Needs -mcpu=v3 (atomic fetch-add with return value).
+ *   TC_TIME_BINS       Bucket the counters of every key by bpf_ktime_get_ns() / bin_width into
+ *                      a ring of sub-second bins (see traffic_bins_t). The collector drains one
+ *                      full second at 1 Hz. Needs -mcpu=v3 (compare-and-swap).
+ *   TC_RINGBUF         Keep the cumulative counters and also emit per-key summary records
+ *                      (traffic_event_t) to a BPF_MAP_TYPE_RINGBUF every N packets or T ns.
+ *                      Needs -mcpu=v3 (compare-and-swap).
+ *   TC_FLOW_KEYS       Key the (LRU/per-CPU) hash map by traffic_flow_key_t, i.e. src/dst IP,
+ *                      src/dst port and protocol, instead of one IP and the protocol.
+ *   TC_IPV6            Also count IPv6 packets, by 128-bit address, in a separate <map>6 hash
+ *                      map (default or TC_PERCPU_MAP). Extension headers are not walked.
+ *   TC_VLAN            Strip up to TC_MAX_VLAN_TAGS 802.1Q/802.1ad tags (VLAN and QinQ) before
+ *                      the L3 header, see tc_walk_eth().
+ *   TC_DECAP           Key IPv4 VXLAN (UDP 4789), GRE and IP-in-IP packets by the inner IPv4
+ *                      header instead of the tunnel endpoints, see tc_walk_ipv4().
+ *
+ * The tc_count_* helpers return a negative value when a packet could not be counted because
+ * a map was full or an entry could not be created; the programs add those packets to the
+ * per-CPU <map>_ovf counter (TC_OVERFLOW_MAP).
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef TC_KERN_H
+#define TC_KERN_H
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#include "tc_common.h"
+
+#if defined(TC_PERCPU_MAP) + defined(TC_MMAP_COUNTERS) + defined(TC_TIME_BINS) + defined(TC_RINGBUF) > 1
+#error "TC_PERCPU_MAP, TC_MMAP_COUNTERS, TC_TIME_BINS and TC_RINGBUF are exclusive"
+#endif
+
+#if defined(TC_FLOW_KEYS) && (defined(TC_MMAP_COUNTERS) || defined(TC_TIME_BINS) || defined(TC_RINGBUF))
+#error "TC_FLOW_KEYS is only supported with the hash maps (default or TC_PERCPU_MAP)"
+#endif
+
+#if defined(TC_IPV6) && (defined(TC_MMAP_COUNTERS) || defined(TC_TIME_BINS) || defined(TC_RINGBUF) || defined(TC_FLOW_KEYS))
+#error "TC_IPV6 is only supported with the per-IP hash maps (default or TC_PERCPU_MAP)"
+#endif
+
+#ifdef TC_FLOW_KEYS
+#define TC_KEY_TYPE struct traffic_flow_key_t
+#else
+#define TC_KEY_TYPE struct traffic_key_t
+#endif
+
+#ifdef TC_PERCPU_MAP
+#define TC_COUNTER_MAP_TYPE BPF_MAP_TYPE_LRU_PERCPU_HASH
+#else
+#define TC_COUNTER_MAP_TYPE BPF_MAP_TYPE_LRU_HASH
+#endif
+
+// VLAN tags stripped by tc_walk_eth(): the outer S-tag and the inner C-tag of QinQ.
+#define TC_MAX_VLAN_TAGS 2
+
+// IANA VXLAN port, matched on the outer UDP destination port.
+#define TC_VXLAN_PORT 4789
+
+// GRE flag bits (RFC 2784/2890) and the version field, see tc_walk_ipv4().
+#define TC_GRE_CSUM    0x8000
+#define TC_GRE_ROUTING 0x4000
+#define TC_GRE_KEY     0x2000
+#define TC_GRE_SEQ     0x1000
+#define TC_GRE_VERSION 0x0007
+
+// 802.1Q/802.1ad tag following the MAC addresses; not in the uapi headers.
+struct tc_vlanhdr {
+    __be16 tci;
+    __be16 encap_proto;
+};
+
+// Fixed part of the GRE header; optional checksum, key and sequence words follow.
+struct tc_grehdr {
+    __be16 flags;
+    __be16 proto;
+};
+
+// VXLAN header (RFC 7348); the inner Ethernet frame follows.
+struct tc_vxlanhdr {
+    __be32 flags;  // 0x08000000: the VNI is valid
+    __be32 vni;
+};
+
+// Slots of the mmapable counter array, including the allocator header at TC_MMAP_HDR_SLOT.
+#define TC_MMAP_SLOTS 2049
+
+// Keys of the time-binned map. Each entry is a 64 KiB traffic_bins_t and LRU maps are
+// preallocated, so this is much smaller than the 2048 keys of the cumulative map.
+#define TC_BINS_MAX_KEYS 256
+
+// Size of the summary-record ring buffer in bytes, a power-of-2 multiple of the page size.
+#define TC_RB_BYTES (4 * 1024 * 1024)
+
+/**
+ * Add one packet of `len` bytes to a counter entry.
+ * A per-CPU entry is only touched by the current core, so no atomic is needed there.
+ */
+static __always_inline void tc_count(struct traffic_val_t *val, __u64 len) {
+#ifdef TC_PERCPU_MAP
+    val->packets += 1;
+    val->bytes += len;
+#else
+    __sync_fetch_and_add(&val->packets, 1);
+    __sync_fetch_and_add(&val->bytes, len);
+#endif
+}
+
+/**
+ * Walk an Ethernet header at `data` and, with -DTC_VLAN, up to TC_MAX_VLAN_TAGS VLAN tags.
+ * The loop has a constant bound, so the verifier sees at most two extra header reads.
+ *
+ * Tags the NIC already stripped into skb->vlan_tci (VLAN RX offload) never show up here.
+ *
+ * @param h_proto  Set to the EtherType of the L3 header, network order.
+ * @return Start of the L3 header, or 0 if the headers are truncated.
+ */
+static __always_inline void *tc_walk_eth(void *data, void *data_end, __be16 *h_proto) {
+    struct ethhdr *eth = data;
+    if ((void *)(eth + 1) > data_end)
+        return 0;
+
+    void *cursor = eth + 1;
+    __be16 proto = eth->h_proto;
+#ifdef TC_VLAN
+#pragma unroll
+    for (int i = 0; i < TC_MAX_VLAN_TAGS; i++) {
+        if (proto != bpf_htons(ETH_P_8021Q) && proto != bpf_htons(ETH_P_8021AD))
+            break;
+        struct tc_vlanhdr *vlan = cursor;
+        if ((void *)(vlan + 1) > data_end)
+            return 0;
+        proto = vlan->encap_proto;
+        cursor = vlan + 1;
+    }
+#endif
+    *h_proto = proto;
+    return cursor;
+}
+
+/**
+ * With -DTC_DECAP, return the inner IPv4 header of an IPv4 tunnel packet; else return `ip`.
+ *
+ * One level of IP-in-IP, GRE (inner IPv4 or transparent Ethernet bridging) and VXLAN is
+ * decapsulated. The inner Ethernet header of GRE-TEB and VXLAN goes through tc_walk_eth(),
+ * so its VLAN tags are stripped too with -DTC_VLAN. Fragments, GRE with routing or a
+ * non-zero version, and tunnels whose payload is not IPv4 are counted by the outer header.
+ *
+ * @param ip  Outer IPv4 header, already checked against `data_end`.
+ * @return An IPv4 header checked against `data_end`.
+ */
+static __always_inline struct iphdr *tc_walk_ipv4(struct iphdr *ip, void *data_end) {
+#ifdef TC_DECAP
+    if (ip->ihl < 5 || (ip->frag_off & bpf_htons(0x3FFF)))  // MF set or offset != 0
+        return ip;
+
+    void *l4 = (void *)ip + ip->ihl * 4;
+    void *inner_eth = 0;
+    struct iphdr *inner = 0;
+
+    if (ip->protocol == IPPROTO_IPIP) {
+        inner = l4;
+    } else if (ip->protocol == IPPROTO_GRE) {
+        struct tc_grehdr *gre = l4;
+        if ((void *)(gre + 1) > data_end)
+            return ip;
+        __u16 flags = bpf_ntohs(gre->flags);
+        if (flags & (TC_GRE_ROUTING | TC_GRE_VERSION))
+            return ip;
+        void *payload = gre + 1;
+        if (flags & TC_GRE_CSUM)
+            payload += 4;
+        if (flags & TC_GRE_KEY)
+            payload += 4;
+        if (flags & TC_GRE_SEQ)
+            payload += 4;
+        if (gre->proto == bpf_htons(ETH_P_IP))
+            inner = payload;
+        else if (gre->proto == bpf_htons(ETH_P_TEB))
+            inner_eth = payload;
+    } else if (ip->protocol == IPPROTO_UDP) {
+        struct udphdr *udp = l4;
+        if ((void *)(udp + 1) > data_end)
+            return ip;
+        if (udp->dest == bpf_htons(TC_VXLAN_PORT))
+            inner_eth = (void *)(udp + 1) + sizeof(struct tc_vxlanhdr);
+    }
+
+    if (inner_eth) {
+        __be16 inner_proto;
+        inner = tc_walk_eth(inner_eth, data_end, &inner_proto);
+        if (!inner || inner_proto != bpf_htons(ETH_P_IP))
+            return ip;
+    }
+    if (!inner || (void *)(inner + 1) > data_end || inner->version != 4)
+        return ip;
+    return inner;
+#else
+    (void)data_end;
+    return ip;
+#endif
+}
+
+/**
+ * Fill a flow key from an IPv4 header already checked against `data_end`.
+ *
+ * TCP and UDP both start with the 16-bit source and destination ports, so one UDP header
+ * read serves both. Non-first fragments carry no L4 header and get ports 0.
+ *
+ * @return 0 on success, -1 if the L4 header is truncated.
+ */
+static __always_inline int tc_fill_flow_key(struct traffic_flow_key_t *flow,
+                                            struct iphdr *ip, void *data_end) {
+    flow->saddr = ip->saddr;
+    flow->daddr = ip->daddr;
+    flow->proto = ip->protocol;
+    flow->sport = 0;
+    flow->dport = 0;
+    flow->pad[0] = flow->pad[1] = flow->pad[2] = 0;
+
+    if (ip->frag_off & bpf_htons(0x1FFF))  // fragment offset != 0
+        return 0;
+
+    struct udphdr *l4 = (void *)ip + ip->ihl * 4;
+    if ((void *)(l4 + 1) > data_end)
+        return -1;
+    flow->sport = l4->source;
+    flow->dport = l4->dest;
+    return 0;
+}
+
+/**
+ * Define the per-CPU overflow counter `<name>_ovf`: packets of the program that were not
+ * counted because a map update failed or no entry was found after creating it.
+ */
+#define TC_OVERFLOW_MAP(name)                               \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);                \
+    __uint(max_entries, 1);                                 \
+    __type(key, __u32);                                     \
+    __type(value, __u64);                                   \
+} name##_ovf SEC(".maps");
+
+/**
+ * Add one packet to the overflow counter. The counter is per-CPU, so no atomic is needed.
+ */
+static __always_inline void tc_count_overflow(void *ovf_map) {
+    __u32 zero_idx = 0;
+    __u64 *cnt = bpf_map_lookup_elem(ovf_map, &zero_idx);
+    if (cnt)
+        *cnt += 1;
+}
+
+/**
+ * Count one packet in the (LRU) hash map, creating the entry on its first packet.
+ * `key` points to a TC_KEY_TYPE. A new entry is stamped with its creation time so the
+ * collector can tell an evicted and re-inserted key from a counter that went backwards.
+ * If two CPUs create the same key, the first entry wins (BPF_NOEXIST) and both count
+ * into it, so neither the packets nor the creation time are replaced.
+ */
+static __always_inline int tc_count_hash(void *map, void *key, __u64 len) {
+    struct traffic_val_t *val = bpf_map_lookup_elem(map, key);
+    if (!val) {
+        // Create a new map entry. Fill the key not the counters
+        struct traffic_val_t zero = { .created_ns = bpf_ktime_get_ns() };
+        bpf_map_update_elem(map, key, &zero, BPF_NOEXIST);
+        val = bpf_map_lookup_elem(map, key);
+        if (!val)
+            return -1;
+    }
+
+    tc_count(val, len);
+    return 0;
+}
+
+/**
+ * Define the IPv6 hash map `<name>6` next to the program's IPv4 map `name`.
+ */
+#define TC_IPV6_MAP(name)                                   \
+struct {                                                    \
+    __uint(type, TC_COUNTER_MAP_TYPE);                      \
+    __uint(max_entries, 2048);                              \
+    __type(key, struct traffic_key6_t);                     \
+    __type(value, struct traffic_val_t);                    \
+} name##6 SEC(".maps");
+
+/**
+ * Count one IPv6 TCP/UDP packet by its source (`use_daddr` = 0) or destination address.
+ * Bytes are the L3 and above length, like `tot_len` for IPv4. The unspecified address
+ * (::) is ignored like 0.0.0.0.
+ */
+static __always_inline int tc_count_ipv6(void *map, struct ipv6hdr *ip6, void *data_end, int use_daddr) {
+    if ((void *)(ip6 + 1) > data_end)
+        return 0;
+    if (ip6->nexthdr != IPPROTO_TCP && ip6->nexthdr != IPPROTO_UDP)
+        return 0;
+
+    struct traffic_key6_t key = {};
+    __builtin_memcpy(key.ip6, use_daddr ? &ip6->daddr : &ip6->saddr, sizeof(key.ip6));
+    key.proto = ip6->nexthdr;
+
+    __u32 *words = (__u32 *)key.ip6;
+    if ((words[0] | words[1] | words[2] | words[3]) == 0)
+        return 0;
+
+    return tc_count_hash(map, &key, bpf_ntohs(ip6->payload_len) + sizeof(*ip6));
+}
+
+/**
+ * Define the three maps of the mmapable layout for the program's map `name`:
+ *   <name>_idx  key -> slot index hash, only used by the kernel.
+ *   <name>_ctr  BPF_F_MMAPABLE counters by slot; slot 0 is the allocator header.
+ *   <name>_key  BPF_F_MMAPABLE key by slot, the side channel for new slot assignments.
+ */
+#define TC_MMAP_MAPS(name)                                  \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_HASH);                        \
+    __uint(max_entries, TC_MMAP_SLOTS);                     \
+    __type(key, struct traffic_key_t);                      \
+    __type(value, __u32);                                   \
+} name##_idx SEC(".maps");                                  \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_ARRAY);                       \
+    __uint(map_flags, BPF_F_MMAPABLE);                      \
+    __uint(max_entries, TC_MMAP_SLOTS);                     \
+    __type(key, __u32);                                     \
+    __type(value, struct traffic_val_t);                    \
+} name##_ctr SEC(".maps");                                  \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_ARRAY);                       \
+    __uint(map_flags, BPF_F_MMAPABLE);                      \
+    __uint(max_entries, TC_MMAP_SLOTS);                     \
+    __type(key, __u32);                                     \
+    __type(value, struct traffic_key_t);                    \
+} name##_key SEC(".maps");
+
+/**
+ * Count one packet in the mmapable counter array.
+ *
+ * A new key takes the next slot from the header. If two CPUs race on the same new key,
+ * the loser's slot stays unused; it still records the key so the collector can tell
+ * the dead slot from one whose key is not written yet. Slots are never recycled.
+ */
+static __always_inline int tc_count_mmap(void *idx_map, void *ctr_map, void *key_map,
+                                         struct traffic_key_t *key, __u64 len) {
+    __u32 slot;
+    __u32 *found = bpf_map_lookup_elem(idx_map, key);
+    if (found) {
+        slot = *found;
+    } else {
+        __u32 hdr_slot = TC_MMAP_HDR_SLOT;
+        struct traffic_val_t *hdr = bpf_map_lookup_elem(ctr_map, &hdr_slot);
+        if (!hdr)
+            return -1;
+        slot = __sync_fetch_and_add(&hdr->packets, 1) + 1;
+        if (slot >= TC_MMAP_SLOTS)  // array is full
+            return -1;
+
+        int lost = bpf_map_update_elem(idx_map, key, &slot, BPF_NOEXIST);
+        struct traffic_key_t *slot_key = bpf_map_lookup_elem(key_map, &slot);
+        if (slot_key)
+            *slot_key = *key;
+        if (lost) {
+            found = bpf_map_lookup_elem(idx_map, key);
+            if (!found)
+                return -1;
+            slot = *found;
+        }
+    }
+
+    struct traffic_val_t *val = bpf_map_lookup_elem(ctr_map, &slot);
+    if (!val)
+        return -1;
+    tc_count(val, len);
+    return 0;
+}
+
+/**
+ * Define the maps of the time-binned layout for the program's map `name`:
+ *   name        LRU hash, key -> traffic_bins_t.
+ *   <name>_cfg  Single-entry config array with the bin width, written by the collector.
+ *   <name>_zero Single all-zero traffic_bins_t to create new entries from; it does not fit
+ *               on the 512-byte BPF stack.
+ */
+#define TC_BINS_MAPS(name)                                  \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);                    \
+    __uint(max_entries, TC_BINS_MAX_KEYS);                  \
+    __type(key, struct traffic_key_t);                      \
+    __type(value, struct traffic_bins_t);                   \
+} name SEC(".maps");                                        \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_ARRAY);                       \
+    __uint(max_entries, 1);                                 \
+    __type(key, __u32);                                     \
+    __type(value, struct traffic_bin_cfg_t);                \
+} name##_cfg SEC(".maps");                                  \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_ARRAY);                       \
+    __uint(max_entries, 1);                                 \
+    __type(key, __u32);                                     \
+    __type(value, struct traffic_bins_t);                   \
+} name##_zero SEC(".maps");
+
+/**
+ * Count one packet in the bin of the current time period.
+ *
+ * The first CPU to see a bin with a stale tag claims it with a compare-and-swap and clears
+ * it. Packets counted by other CPUs between the claim and the clear are lost; that window
+ * is a few instructions wide, once per bin period.
+ */
+static __always_inline int tc_count_bins(void *map, void *cfg_map, void *zero_map,
+                                         struct traffic_key_t *key, __u64 len) {
+    __u32 zero_idx = 0;
+    struct traffic_bin_cfg_t *cfg = bpf_map_lookup_elem(cfg_map, &zero_idx);
+    __u64 width = (cfg && cfg->bin_width_ns) ? cfg->bin_width_ns : TC_DEFAULT_BIN_WIDTH_NS;
+    __u64 period = bpf_ktime_get_ns() / width;
+
+    struct traffic_bins_t *val = bpf_map_lookup_elem(map, key);
+    if (!val) {
+        struct traffic_bins_t *zero = bpf_map_lookup_elem(zero_map, &zero_idx);
+        if (!zero)
+            return -1;
+        bpf_map_update_elem(map, key, zero, BPF_NOEXIST);
+        val = bpf_map_lookup_elem(map, key);
+        if (!val)
+            return -1;
+    }
+
+    struct traffic_bin_t *bin = &val->bins[period & (TC_NUM_BINS - 1)];
+    __u32 tag = (__u32)period;
+    __u32 old = bin->tag;
+    if (old != tag && __sync_val_compare_and_swap(&bin->tag, old, tag) == old) {
+        bin->packets = 0;
+        bin->bytes = 0;
+    }
+    __sync_fetch_and_add(&bin->packets, 1);
+    __sync_fetch_and_add(&bin->bytes, len);
+    return 0;
+}
+
+/**
+ * Define the maps of the ring-buffer layout for the program's map `name`:
+ *   name        LRU hash, key -> traffic_rb_state_t.
+ *   <name>_rb   BPF_MAP_TYPE_RINGBUF of traffic_event_t records.
+ *   <name>_cfg  Single-entry config array with the emission thresholds, written by the collector.
+ */
+#define TC_RINGBUF_MAPS(name)                               \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);                    \
+    __uint(max_entries, 2048);                              \
+    __type(key, struct traffic_key_t);                      \
+    __type(value, struct traffic_rb_state_t);               \
+} name SEC(".maps");                                        \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_RINGBUF);                     \
+    __uint(max_entries, TC_RB_BYTES);                       \
+} name##_rb SEC(".maps");                                   \
+struct {                                                    \
+    __uint(type, BPF_MAP_TYPE_ARRAY);                       \
+    __uint(max_entries, 1);                                 \
+    __type(key, __u32);                                     \
+    __type(value, struct traffic_rb_cfg_t);                 \
+} name##_cfg SEC(".maps");
+
+/**
+ * Count one packet and emit the key's cumulative counters when either threshold is reached.
+ *
+ * Only the CPU that moves `last_emit_ns` forward emits, so concurrent packets of one key
+ * produce one record. Packets after a key's last record show up with its next record.
+ * A full ring buffer is reported as an overflow; the packet itself is counted.
+ */
+static __always_inline int tc_count_ringbuf(void *map, void *rb, void *cfg_map,
+                                            struct traffic_key_t *key, __u64 len) {
+    struct traffic_rb_state_t *st = bpf_map_lookup_elem(map, key);
+    if (!st) {
+        struct traffic_rb_state_t zero = { .val.created_ns = bpf_ktime_get_ns() };
+        bpf_map_update_elem(map, key, &zero, BPF_NOEXIST);  // a racing CPU's entry wins
+        st = bpf_map_lookup_elem(map, key);
+        if (!st)
+            return -1;
+    }
+    tc_count(&st->val, len);
+
+    __u32 zero_idx = 0;
+    struct traffic_rb_cfg_t *cfg = bpf_map_lookup_elem(cfg_map, &zero_idx);
+    __u64 every_ns = (cfg && cfg->emit_every_ns) ? cfg->emit_every_ns : TC_RB_DEFAULT_EVERY_NS;
+    __u64 every_packets = (cfg && cfg->emit_every_packets) ?
+        cfg->emit_every_packets : TC_RB_DEFAULT_EVERY_PACKETS;
+
+    __u64 now = bpf_ktime_get_ns();
+    __u64 last = st->last_emit_ns;
+    if (now - last < every_ns && st->val.packets - st->last_emit_packets < every_packets)
+        return 0;
+    if (__sync_val_compare_and_swap(&st->last_emit_ns, last, now) != last)
+        return 0;  // another CPU is emitting this key
+    st->last_emit_packets = st->val.packets;
+
+    struct traffic_event_t *ev = bpf_ringbuf_reserve(rb, sizeof(*ev), 0);
+    if (!ev)
+        return -1;
+    ev->key = *key;
+    ev->val.packets = st->val.packets;
+    ev->val.bytes = st->val.bytes;
+    ev->val.created_ns = st->val.created_ns;
+    ev->ts_ns = now;
+    bpf_ringbuf_submit(ev, 0);
+    return 0;
+}
+
+#endif
@@ -9,6 +9,13 @@
  * 
  * Run it with sudo:
  *   sudo ./<this-file>.o -p|--poll-frequency <target_freq> -m|--map-path <path>
+ *   Optional: -v|--verbose, -s|--stats (self-telemetry to stderr), --no-batch (per-key map walk),
+ *             -b|--backend hash|mmap|bins|ringbuf (all but hash need kernel programs built
+ *             with MMAP=1/BINS=1/RINGBUF=1), -w|--bin-width-us <us> (bins, default 500),
+ *             --emit-every-us <us>, --emit-every-packets <n> (ringbuf, default 1000 us / 1024),
+ *             --map6-path <path> (IPv6 map of IPV6=1 kernel programs, hash backend only),
+ *             --load <kernel-obj.o> [--max-entries <n>] (load, resize and pin the kernel
+ *             program and maps under the map path; attach it with tc/ip afterwards)
  * 
  * @author: xmei@jlab.org, ChatGPT
  * First checked in @date: July 16, 2025
@@ -20,25 +27,46 @@
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include <thread>
 #include <atomic>
 #include <map>
+#include <array>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <new>
+#include <cstdlib>
 #include <vector>
 #include <chrono>
 #include <mutex>
 #include <shared_mutex>
+#include <condition_variable>
 #include <csignal>
 #include <sstream>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+#include <cerrno>
 
 #include <netinet/in.h>  // For ntohl
 #include <arpa/inet.h>   // For inet_ntop
 
 #include "json.hpp"      // external files downloaded online
-#include "tc_common.h"   // header file for this project only
+#include "tc_common.h"
+#include "window_store.h"
+#include "delta_kernel.h"
+#include "history_store.h"
+#include "rollup_store.h"
+#include "json_writer.h"
+#include "tc_binary.h"
+#include "shm_ring.h"
+#include "metrics_server.h"     // header file for this project only
 
 
 using json = nlohmann::json;
@@ -48,10 +76,47 @@ using TimePoint = std::chrono::time_point<Clock>;
 
 // ......... Default Command-Line Parameters ..............................
 std::string map_path = "/sys/fs/bpf/tc-eg";
+std::string map6_path = "";    // IPv6 map of -DTC_IPV6 kernel programs, "hash" backend only
+std::string load_obj = "";     // kernel ELF object to load and pin under map_path before collecting
+__u32 max_entries = 0;         // resize the object's LRU maps before loading, 0 keeps the ELF size
 /// TODO: now it's fixed at reporting every 1 second.
 /// Make it adjustable.
 int export_interval = 1;    // in seconds
 int poll_hz = 20;
+uint32_t window_ticks = 0;  // ticks per window: `poll_hz`, or 1 s / bin width for "bins"; set in main()
+bool use_batch = true;      // bpf_map_lookup_batch when the kernel supports it
+// "hash": walk the LRU hash map; "mmap": read the BPF_F_MMAPABLE counter array;
+// "bins": drain the in-kernel time bins once per second; "ringbuf": consume summary records
+std::string backend = "hash";
+__u64 bin_width_ns = TC_DEFAULT_BIN_WIDTH_NS;  // "bins" backend only
+__u64 emit_every_ns = TC_RB_DEFAULT_EVERY_NS;  // "ringbuf" backend only
+__u64 emit_every_packets = TC_RB_DEFAULT_EVERY_PACKETS;
+bool print_stats = false;   // per-second collector self-telemetry to stderr
+size_t export_queue_len = 4;    // windows waiting for the exporter thread
+// "drop-oldest": a full queue drops its oldest window; "block": the poll thread waits for room
+std::string export_policy = "drop-oldest";
+int export_cpu = -1;        // pin the exporter thread to this CPU, -1 leaves it unpinned
+// How the "hash"/"mmap" poll loop waits for a deadline: "sleep", "spin" (busy-poll the
+// clock) or "hybrid" (sleep, then spin the last `spin_ns`)
+std::string wait_mode = "sleep";
+__u64 spin_ns = 50000;      // "hybrid" only
+int poll_cpu = -1;          // pin the poll thread to this CPU, -1 leaves it unpinned
+int fifo_prio = 0;          // run the poll thread as SCHED_FIFO with this priority, 0 keeps SCHED_OTHER
+// "deltas": per-tick deltas; "rates": per-second rates over the measured tick durations;
+// "timestamps": deltas plus the "tick_ns" sampling times of the window
+std::string export_mode = "deltas";
+// Bin arrays of the report: "dense", "sparse" (non-zero ticks only) or "rle" (zero runs
+// as negative counts), see `BinEncoding`
+std::string bin_encoding = "dense";
+std::string binary_out;     // write the windows to this file in the binary format (tc_binary.h) instead of JSON
+std::string shm_ring_name;  // also publish the windows to /dev/shm/<name> (shm_ring.h), empty = off
+size_t shm_ring_mb = 256;   // data area of the shared-memory ring
+size_t shm_ring_windows = 60;   // windows indexed by the shared-memory ring
+uint16_t metrics_port = 0;  // serve OpenMetrics on 127.0.0.1:<port> (metrics_server.h), 0 = off
+time_t history_sec = 0;     // keep the compressed windows of the last N seconds, 0 = off
+size_t rollup_1s_slots = 0; // periods kept per IP by the 1 s rollup tier, 0 = off
+size_t rollup_1m_slots = 0; // periods kept per IP by the 1 min rollup tier, 0 = off
+bool rollup_export = false; // print every finished rollup period to stdout
 
 const unsigned int SLOTS_IN_GLOBAL_RING_BUFFER = 60;
 // ---------------------------------------
@@ -66,36 +131,530 @@ struct LastSeen {
     __u64 udp_packets = 0;
 };
 
-// ++ Data structure to store the snapshot values for every IP address
-struct BinsPerIP {
-    std::vector<__u64> tcp_bytes;
-    std::vector<__u64> tcp_packets;
-    std::vector<__u64> udp_bytes;
-    std::vector<__u64> udp_packets;
-
-    BinsPerIP() = default;
-    explicit BinsPerIP(size_t n)
-        : tcp_bytes(n, 0),
-          tcp_packets(n, 0),
-          udp_bytes(n, 0),
-          udp_packets(n, 0) {};
+// The last-seen counter of metric `m`.
+inline __u64& seen_field(LastSeen& seen, const WindowMetric m) {
+    switch (m) {
+    case TCP_BYTES:     return seen.tcp_bytes;
+    case TCP_PACKETS:   return seen.tcp_packets;
+    case UDP_BYTES:     return seen.udp_bytes;
+    default:            return seen.udp_packets;
+    }
+}
+
+// ++ Per coarse-grained data structure, generic over the address family.
+//    Every slot is a flat `WindowStore` (see window_store.h) of the per-tick cumulative
+//    counters of every IP in that second.
+template <typename Key>
+using WindowRing = std::array<WindowStore<Key>, SLOTS_IN_GLOBAL_RING_BUFFER>;
+
+template <typename Key>
+using LastSeenMap = std::map<Key, LastSeen>;
+
+// Keyed by the IPv4 address, or by a flow ID from `flows` for flow-keyed maps.
+WindowRing<uint32_t> gBuffer;
+// Keyed by the IPv6 address, filled only from the <map>6 maps of -DTC_IPV6 kernel programs.
+WindowRing<Ip6Addr> gBuffer6;
+
+// ++ Compressed copies of the exported windows, beyond the ring's 60 seconds
+//    (see history_store.h). Appended by the exporter thread, decodable from any thread.
+HistoryStore<uint32_t> history;
+HistoryStore<Ip6Addr> history6;
+
+// ++ Rollup tiers of the exported windows' tick deltas (see rollup_store.h), fed by the
+//    exporter thread one window at a time and queryable from any thread.
+template <typename Key>
+struct RollupTiers {
+    RollupTier<Key> sec;    // 1 s periods
+    RollupTier<Key> min;    // 1 min periods, merged from the 1 s aggregates
+
+    void expire(const time_t second) {
+        sec.expire(second);
+        min.expire(second);
+    }
+};
+
+RollupTiers<uint32_t> rollups;
+RollupTiers<Ip6Addr> rollups6;
+
+// ++ Owner of every ring slot, shared by `gBuffer` and `gBuffer6`.
+//    A slot belongs to the poll thread until `publish_window()` hands it to the exporter,
+//    which owns it exclusively until `return_window()`, after serializing and clearing it.
+//    The release store and acquire load of the flag order the bins, so no side takes a lock.
+enum SlotOwner : int {
+    SLOT_POLLER = 0,
+    SLOT_EXPORTER = 1,
+};
+std::array<std::atomic<int>, SLOTS_IN_GLOBAL_RING_BUFFER> slot_owner{};
+
+// ++ Kernel entry incarnations of every key, to detect LRU evictions.
+//    An evicted key comes back with zeroed counters and a new `created_ns`; its counters
+//    are rebased onto the previous incarnation's so the windows stay cumulative.
+//    The "bins" backend has no `created_ns` and keeps its running totals in `last`.
+struct Incarnation {
+    __u64 created_ns = 0;   // traffic_val_t::created_ns of the current kernel entry
+    traffic_val_t base{};   // counters carried over from the previous incarnations
+    traffic_val_t last{};   // latest rebased counters
+    bool seen = false;          // read from the kernel map in the current window
+    uint32_t idle_windows = 0;  // polled windows since the key was last read, see `expire_idle_keys()`
+};
+
+template <typename Key>
+struct IncarnationTable {
+    std::map<Key, Incarnation> tcp;
+    std::map<Key, Incarnation> udp;
+};
+
+IncarnationTable<uint32_t> incarnations;
+IncarnationTable<Ip6Addr> incarnations6;
+
+// Polled windows a key may be missing from the kernel map before it is forgotten.
+const uint32_t KEY_EXPIRY_WINDOWS = 10;
+
+// ++ Keys forgotten by the poll thread (`expire_idle_keys()`), each with the second of
+//    the last window handed to the exporter before it expired. The exporter drops their
+//    `last_seen` counters before it exports any later window (`drop_expired_keys()`).
+template <typename Key>
+class ExpiredKeys {
+public:
+    void push(const time_t second, const std::vector<Key>& keys) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const Key& key : keys)
+            items_.emplace_back(second, key);
+    }
+
+    // Move the keys expired before the window of `second` to `out`.
+    void take(const time_t second, std::vector<Key>& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!items_.empty() && items_.front().first < second) {
+            out.push_back(items_.front().second);
+            items_.pop_front();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<std::pair<time_t, Key>> items_;
 };
 
-// ++ Per coarse-grained data structure
-std::map<uint32_t, BinsPerIP> window; 
+ExpiredKeys<uint32_t> expired_keys;
+ExpiredKeys<Ip6Addr> expired_keys6;
+
+// ++ Flat snapshot of one poll, reused across polls so that steady-state polling does not
+//    allocate. Entries are in map order; a key read twice (map walk restarts) appears twice
+//    and the later value wins when appended to the window.
+template <typename Key>
+struct SnapshotEntry {
+    Key key;
+    traffic_val_t val;
+};
+
+template <typename Key>
+struct SnapshotBuffer {
+    std::vector<SnapshotEntry<Key>> tcp;
+    std::vector<SnapshotEntry<Key>> udp;
+
+    void reserve(size_t n) { tcp.reserve(n); udp.reserve(n); }
+    void clear() { tcp.clear(); udp.clear(); }
+};
+
+// ++ Dense 32-bit IDs for the flows of kernel programs built with -DTC_FLOW_KEYS,
+//    so that the per-window containers stay keyed by uint32_t for both key kinds.
+struct FlowTuple {
+    __u32 saddr;    // network order
+    __u32 daddr;    // network order
+    __u16 sport;    // network order
+    __u16 dport;    // network order
+
+    bool operator==(const FlowTuple& o) const {
+        return saddr == o.saddr && daddr == o.daddr && sport == o.sport && dport == o.dport;
+    }
+};
+
+struct FlowTupleHash {
+    size_t operator()(const FlowTuple& t) const {
+        __u64 a = (static_cast<__u64>(t.saddr) << 32) | t.daddr;
+        __u64 b = (static_cast<__u64>(t.sport) << 16) | t.dport;
+        return std::hash<__u64>{}(a ^ (b * 0x9E3779B97F4A7C15ULL));
+    }
+};
+
+// IDs are handed out by the poll thread and resolved back to tuples by the exporter.
+// TCP and UDP flows of the same 4-tuple share an ID; the protocol picks the metric fields.
+// Only the poll thread touches `ids_`, so a known flow is looked up without a lock; the
+// lock only guards `tuples_` and `free_` against the exporter while a new flow is added.
+// The ID of a flow the kernel map dropped is retired by the poll thread, and reused once
+// the exporter releases it (see `expire_idle_keys()` and `drop_expired_keys()`).
+class FlowTable {
+public:
+    uint32_t intern(const FlowTuple& t) {
+        auto it = ids_.find(t);
+        if (it != ids_.end())
+            return it->second;
+
+        std::unique_lock lock(mutex_);
+        uint32_t id;
+        if (!free_.empty()) {
+            id = free_.back();
+            free_.pop_back();
+            tuples_[id] = t;
+        } else {
+            id = static_cast<uint32_t>(tuples_.size());
+            tuples_.push_back(t);
+        }
+        ids_.emplace(t, id);
+        return id;
+    }
+
+    // Poll thread: the flow of `id` expired, a later packet of its tuple gets a new ID.
+    // `tuple(id)` still resolves it until `release()`.
+    void retire(uint32_t id) {
+        ids_.erase(tuples_[id]);
+    }
+
+    // Exporter: no window, counter or store refers to `id` any more, hand it out again.
+    void release(uint32_t id) {
+        std::unique_lock lock(mutex_);
+        free_.push_back(id);
+    }
+
+    FlowTuple tuple(uint32_t id) const {
+        std::shared_lock lock(mutex_);
+        return tuples_[id];
+    }
+
+    // IDs in use, retired ones included until they are released.
+    size_t size() const {
+        std::shared_lock lock(mutex_);
+        return tuples_.size() - free_.size();
+    }
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<FlowTuple, uint32_t, FlowTupleHash> ids_;
+    std::deque<FlowTuple> tuples_;
+    std::vector<uint32_t> free_;    // released IDs
+};
+
+bool flow_keys = false;     // set when the map key is a traffic_flow_key_t
+FlowTable flows;
+
+// ++ Handle of the pinned eBPF map plus the reusable buffers to read it
+struct MapReader {
+    int fd = -1;
+    // sizeof(traffic_flow_key_t) for flow keys, sizeof(traffic_key6_t) for the IPv6 map
+    __u32 key_size = sizeof(traffic_key_t);
+    bool percpu = false;    // BPF_MAP_TYPE_LRU_PERCPU_HASH, one value per possible CPU
+    int num_cpus = 1;
+    std::vector<traffic_val_t> percpu_vals;
+
+    // Batched read path. Buffers are sized to max_entries once and reused every poll.
+    bool batch = false;
+    __u32 max_entries = 0;
+    std::vector<unsigned char> batch_keys;  // max_entries * key_size bytes
+    std::vector<traffic_val_t> batch_vals;  // max_entries * num_cpus values
+
+    // Per-key walk path
+    std::vector<unsigned char> walk_key;
+    std::vector<unsigned char> walk_next_key;
+
+    __u64 last_syscalls = 0;  // bpf() syscalls spent on the latest snapshot
+};
+
+// ++ mmapped counter array of kernel programs built with -DTC_MMAP_COUNTERS
+struct MmapReader {
+    int idx_fd = -1;    // <map_path>_idx, key -> slot
+    int ctr_fd = -1;    // <map_path>_ctr, counters by slot
+    int key_fd = -1;    // <map_path>_key, key by slot
+    const traffic_val_t* ctr = nullptr;
+    const traffic_key_t* keys = nullptr;
+    size_t ctr_len = 0;
+    size_t keys_len = 0;
+    __u32 max_slots = 0;
+
+    // Slots [1, known_slots) are resolved. A dead slot (lost allocation race) has proto 0.
+    __u32 known_slots = 1;
+    std::vector<traffic_key_t> slot_keys;
+
+    __u64 last_syscalls = 0;
+};
+
+// ++ Time-binned map of kernel programs built with -DTC_TIME_BINS
+struct TimeBinsReader {
+    int fd = -1;        // <map_path>, key -> traffic_bins_t
+    int cfg_fd = -1;    // <map_path>_cfg
+    __u32 bins_per_sec = 0;
+    std::unique_ptr<traffic_bins_t> value;  // 64 KiB, reused for every key
+
+    __u64 last_syscalls = 0;
+};
+
+// ++ Ring buffer of kernel programs built with -DTC_RINGBUF
+struct RingbufReader {
+    int map_fd = -1;    // <map_path>, looked up only to tell an idle key from a dropped one
+    int rb_fd = -1;     // <map_path>_rb
+    int cfg_fd = -1;    // <map_path>_cfg
+    struct ring_buffer* rb = nullptr;
+
+    time_t window_second = 0;
+    int window_id = 0;
+    __s64 realtime_minus_mono = 0;  // maps record timestamps to wall-clock ticks
+
+    // Latest cumulative counters per IP, and their values when the current window started.
+    std::map<uint32_t, traffic_val_t> latest_tcp;
+    std::map<uint32_t, traffic_val_t> latest_udp;
+    std::map<uint32_t, traffic_val_t> start_tcp;
+    std::map<uint32_t, traffic_val_t> start_udp;
+};
+
+// ++ Per-CPU overflow counter <map_path>_ovf of the kernel programs: packets not counted
+//    because a map was full or an entry could not be created
+struct OverflowReader {
+    int fd = -1;
+    int num_cpus = 0;
+    std::vector<__u64> percpu_vals;
+    __u64 last_total = 0;
+};
+OverflowReader overflow;
+
+// ++ Histogram of the poll loop's wakeup lateness in ns: log2 buckets split into 8 linear
+//    sub-buckets, so a percentile is within 12.5% of the real value.
+struct JitterHistogram {
+    static constexpr size_t SUB = 8;
+    std::array<__u64, 64 * SUB> counts{};
+    __u64 total = 0;
+    __u64 max_ns = 0;
+
+    static size_t bucket(const __u64 ns) {
+        if (ns < SUB)
+            return static_cast<size_t>(ns);
+        unsigned shift = 63 - __builtin_clzll(ns) - 3;
+        return (shift + 1) * SUB + ((ns >> shift) & (SUB - 1));
+    }
+
+    static __u64 lower_bound(const size_t b) {
+        if (b < SUB)
+            return b;
+        return (SUB + b % SUB) << (b / SUB - 1);
+    }
+
+    void add(const __u64 ns) {
+        counts[bucket(ns)] += 1;
+        total += 1;
+        max_ns = std::max(max_ns, ns);
+    }
+
+    // Lower bound of the bucket holding the `q` quantile, 0 <= q <= 1.
+    __u64 quantile(const double q) const {
+        __u64 rank = static_cast<__u64>(q * total), seen = 0;
+        for (size_t b = 0; b < counts.size(); ++b) {
+            seen += counts[b];
+            if (seen > rank)
+                return lower_bound(b);
+        }
+        return max_ns;
+    }
+};
+
+// ++ Collector self-telemetry, accumulated over one export window
+struct CollectorStats {
+    __u64 polls = 0;
+    __u64 syscalls = 0;
+    __u64 events = 0;   // ring buffer records
+    __u64 evictions = 0;    // keys found re-inserted with a new created_ns
+    __u64 overflows = 0;    // packets the kernel could not count, from <map_path>_ovf
+    __u64 allocs = 0;       // heap allocations of the polling thread, with TC_COUNT_ALLOCS only
+    __u64 busy_polls = 0;   // polls (ring buffer records) dropped, their slot still held by the exporter
+    __u64 missed_ticks = 0;     // poll deadlines passed before the loop got to them
+    JitterHistogram jitter;     // wakeup lateness of the "hash"/"mmap" poll loop
+    __u64 export_queue = 0;     // windows waiting for the exporter after the last handoff
+    __u64 export_dropped = 0;   // windows dropped by the "drop-oldest" policy
+};
+CollectorStats stats;
+JitterHistogram jitter_total;   // the same over the whole run
+
+// ++ Run totals of `stats` for the metrics endpoint. Stored by the poll thread once per
+//    second in `hand_to_exporter()`, read by the exporter when it renders the exposition.
+struct CollectorHealth {
+    std::atomic<__u64> polls{0};
+    std::atomic<__u64> missed_ticks{0};
+    std::atomic<__u64> busy_polls{0};
+    std::atomic<__u64> overflows{0};
+    std::atomic<__u64> evictions{0};
+    std::atomic<__u64> export_dropped{0};
+    std::atomic<__u64> export_queue{0};
+};
+CollectorHealth health;
+CollectorStats stats_reset;     // sums of the `stats` already reset by `print_collector_stats()`
+__u64 evictions_reported = 0;   // evictions warned about by `report_evictions()`, poll thread only
+// -----------------------------
+
+
+// ++ Bounded queue of published windows, from the poll thread to the exporter thread.
+//    One push and one pop per second, so a mutex and condition variables are cheap here;
+//    the bins themselves are handed over by the slot owner flags, not by the queue.
+struct ExportItem {
+    time_t second;
+    int window_id;
+};
+
+class ExportQueue {
+public:
+    explicit ExportQueue(size_t capacity) : items_(std::max<size_t>(capacity, 1)) {}
+
+    /**
+     * @brief Queue `item` for the exporter. When the queue is full, "block" waits for
+     *        room; otherwise the oldest window is removed and returned in `dropped`.
+     *
+     * @return bool  true if a window was dropped to make room.
+     */
+    bool push(const ExportItem& item, const bool block, ExportItem& dropped) {
+        std::unique_lock lock(mutex_);
+        bool was_dropped = false;
+        if (count_ == items_.size()) {
+            if (block) {
+                not_full_.wait(lock, [this] { return count_ < items_.size(); });
+            } else {
+                dropped = items_[head_];
+                head_ = (head_ + 1) % items_.size();
+                count_ -= 1;
+                was_dropped = true;
+            }
+        }
+        items_[(head_ + count_) % items_.size()] = item;
+        count_ += 1;
+        lock.unlock();
+        not_empty_.notify_one();
+        return was_dropped;
+    }
+
+    /**
+     * @brief Wait for the oldest window. After `stop()` the queued windows are still
+     *        returned, then false.
+     */
+    bool pop(ExportItem& item) {
+        std::unique_lock lock(mutex_);
+        not_empty_.wait(lock, [this] { return count_ > 0 || stopped_; });
+        if (count_ == 0)
+            return false;
+        item = items_[head_];
+        head_ = (head_ + 1) % items_.size();
+        count_ -= 1;
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard lock(mutex_);
+            stopped_ = true;
+        }
+        not_empty_.notify_all();
+    }
+
+    size_t depth() {
+        std::lock_guard lock(mutex_);
+        return count_;
+    }
 
-std::array<decltype(window), SLOTS_IN_GLOBAL_RING_BUFFER> gBuffer;
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::vector<ExportItem> items_;     // ring of `capacity` windows
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool stopped_ = false;
+};
 // -----------------------------
 
 
+// ++ Heap allocations of the calling thread, to check that the polling path does not allocate.
+//    Only with -DTC_COUNT_ALLOCS (cmake -DTC_COUNT_ALLOCS=ON), which replaces the global
+//    allocation functions; otherwise the count is a constant 0 and not reported.
+#ifdef TC_COUNT_ALLOCS
+thread_local __u64 thread_allocs = 0;
+
+// The array forms of the standard library forward to these.
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    thread_allocs += 1;
+    return std::malloc(size ? size : 1);
+}
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    thread_allocs += 1;
+    void* p = nullptr;
+    const size_t a = std::max(static_cast<size_t>(align), sizeof(void*));
+    return posix_memalign(&p, a, size ? size : 1) == 0 ? p : nullptr;
+}
+void* operator new(size_t size) {
+    if (void* p = operator new(size, std::nothrow))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new(size_t size, std::align_val_t align) {
+    if (void* p = operator new(size, align, std::nothrow))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+#else
+constexpr __u64 thread_allocs = 0;
+#endif
+
+
 // ......... Global Shared State ..................
 std::atomic<bool> running(true);
 void handle_signal(int) {
     running = false;
 }
 
-std::shared_mutex data_mutex;
 bool first_report = true;
+__u64 last_tick_ns = 0;     // sampling time of the last exported tick, exporter thread only
+// Unprinted period start of the 1 s and 1 min rollup tiers, -1 if none; exporter thread only.
+std::array<time_t, 2> rollup_pending = {-1, -1};
+// Expired flow IDs and the second of the window from which they may be reused; exporter thread only.
+std::deque<std::pair<time_t, uint32_t>> held_flow_ids;
+// Reusable buffers of `window_deltas()` and the report, exporter thread only.
+DeltaWindow window_delta_buf;
+DeltaWindow window_delta_buf6;
+ReportWriter report_writer;
+BinaryWriter binary_writer;     // open with --binary-out
+ShmRingWriter shm_ring;         // open with --shm-ring
+MetricsServer metrics_server;   // started with --metrics-port
+size_t metrics_text_bytes = 0;  // size of the last exposition, reserved for the next
+std::vector<__u64> delta_last_seen;     // rows x NUM_WINDOW_METRICS
+std::vector<LastSeen*> delta_seen_rows;
+
+
+/**
+ * @brief Whether the poll thread may write into the ring slot `window_id`.
+ *
+ * False only while the exporter still holds the slot from `SLOTS_IN_GLOBAL_RING_BUFFER`
+ * seconds ago; the poller then drops its ticks for the slot (`CollectorStats::busy_polls`).
+ */
+inline bool poller_owns(const int window_id) {
+    return slot_owner[window_id].load(std::memory_order_acquire) == SLOT_POLLER;
+}
+
+/**
+ * @brief Hand the finished ring slot `window_id` to the exporter. Called by the poll thread,
+ *        which must not touch the slot again until it is returned.
+ */
+inline void publish_window(const int window_id) {
+    slot_owner[window_id].store(SLOT_EXPORTER, std::memory_order_release);
+}
+
+/**
+ * @brief Give the exported and cleared ring slot `window_id` back to the poll thread.
+ */
+inline void return_window(const int window_id) {
+    slot_owner[window_id].store(SLOT_POLLER, std::memory_order_release);
+}
 
 
 /**
@@ -107,226 +666,965 @@ inline time_t now_sec() {
         std::chrono::system_clock::now());
 }
 
+/**
+ * @brief Return CLOCK_MONOTONIC in nanoseconds, the clock of `bpf_ktime_get_ns()`.
+ */
+inline __u64 monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Return CLOCK_REALTIME in nanoseconds, the clock the windows are keyed by.
+ */
+inline __u64 realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
 /**
  * @brief A helper function to print the per-second raw time-series bins.
+ *        Only call it on a slot published to the caller, see `publish_window()`.
  */
 void print_latest_metric_bin(const time_t print_second) {
     int window_id = print_second % SLOTS_IN_GLOBAL_RING_BUFFER;
-    // std::unique_lock lock(data_mutex);
 
-    auto metric_bins = gBuffer[window_id];
+    const auto& metric_bins = gBuffer[window_id];
     if (metric_bins.empty()) {
         std::cout << "[metric_bins] is empty.\n";
         return;
     }
 
     std::cout << "\nLatest timestamp: " << print_second << std::endl;
-    for (const auto& [ip, bins] : metric_bins) {
-        std::cout << "\n  IP: " << ip << std::endl;
+    for (size_t r = 0; r < metric_bins.size(); ++r) {
+        std::cout << "\n  IP: " << metric_bins.key(r) << std::endl;
 
-        auto print_vec = [](const std::string& label, const std::vector<__u64>& vec) {
+        auto print_vec = [&](const std::string& label, WindowMetric m) {
+            const __u64* vec = metric_bins.row(r, m);
             std::cout << "    " << label << " = [";
-            for (size_t i = 0; i < vec.size(); ++i) {
+            for (size_t i = 0; i < metric_bins.ticks(); ++i) {
                 std::cout << vec[i];
-                if (i != vec.size() - 1) std::cout << ", ";
+                if (i != metric_bins.ticks() - 1) std::cout << ", ";
             }
             std::cout << "]\n";
         };
 
-        print_vec("tcp_bytes", bins.tcp_bytes);
-        print_vec("tcp_packets", bins.tcp_packets);
-        print_vec("udp_bytes", bins.udp_bytes);
-        print_vec("udp_packets", bins.udp_packets);
+        print_vec("tcp_bytes", TCP_BYTES);
+        print_vec("tcp_packets", TCP_PACKETS);
+        print_vec("udp_bytes", UDP_BYTES);
+        print_vec("udp_packets", UDP_PACKETS);
     }
 }
 
 
 /**
- * @brief Compute the difference between consecutive values in a cumulative snapshot vector.
+ * @brief Append the JSON key of one row of a window to `out`: the IPv4 address as an
+ *        integer (network order), or "<saddr>:<sport>-<daddr>:<dport>" for flows, with
+ *        the ports in host order.
+ */
+inline void append_row_label(std::string& out, const uint32_t id) {
+    if (!flow_keys) {
+        append_u64(out, id);
+        return;
+    }
+
+    FlowTuple t = flows.tuple(id);
+    append_u64(out, t.saddr);
+    out.push_back(':');
+    append_u64(out, ntohs(t.sport));
+    out.push_back('-');
+    append_u64(out, t.daddr);
+    out.push_back(':');
+    append_u64(out, ntohs(t.dport));
+}
+
+/**
+ * @brief Append the JSON key of one IPv6 row to `out`: the address in its text form,
+ *        e.g. "2001:db8::1".
+ */
+inline void append_row_label(std::string& out, const Ip6Addr& addr) {
+    char ip_str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, addr.data(), ip_str, sizeof(ip_str));
+    out.append(ip_str);
+}
+
+// Binary key of one row (see tc_binary.h), carrying what its JSON key is made of.
+inline BinaryKey binary_row_key(const uint32_t id) {
+    if (!flow_keys)
+        return binary_key_ipv4(id);
+
+    FlowTuple t = flows.tuple(id);
+    return binary_key_flow4(t.saddr, t.daddr, ntohs(t.sport), ntohs(t.dport));
+}
+
+inline BinaryKey binary_row_key(const Ip6Addr& addr) {
+    return binary_key_ipv6(addr);
+}
+
+// The JSON key of one row as a string.
+template <typename Key>
+inline std::string row_label(const Key& key) {
+    std::string label;
+    append_row_label(label, key);
+    return label;
+}
+
+/**
+ * @brief Open the pinned eBPF map and size the value buffer by its map type.
  *
- * This function generates a delta vector from a cumulative counter vector (`snapshot`),
- * where each element represents the change in value from the previous one.
- * The first delta is computed using the provided `last_seen` value, and all subsequent
- * deltas are computed as `snapshot[i] - snapshot[i - 1]`.
+ * Kernel programs built with -DTC_PERCPU_MAP create a BPF_MAP_TYPE_LRU_PERCPU_HASH,
+ * in which case a lookup returns one `traffic_val_t` per possible CPU.
  *
- * The function does not modify the input `snapshot` vector or `last_seen`.
+ * @return int  0 on success, or -1 if the map cannot be opened or inspected.
+ */
+int open_map_reader(const std::string& path, MapReader& reader) {
+    reader.fd = bpf_obj_get(path.c_str());
+    if (reader.fd < 0)
+        return -1;
+
+    struct bpf_map_info info {};
+    __u32 info_len = sizeof(info);
+    if (bpf_obj_get_info_by_fd(reader.fd, &info, &info_len) != 0)
+        return -1;
+
+    if (info.key_size != sizeof(traffic_key_t) && info.key_size != sizeof(traffic_flow_key_t) &&
+        info.key_size != sizeof(traffic_key6_t)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (info.value_size != sizeof(traffic_val_t)) {  // kernel object older than created_ns
+        errno = EINVAL;
+        return -1;
+    }
+    reader.key_size = info.key_size;
+    if (info.key_size == sizeof(traffic_flow_key_t))
+        flow_keys = true;
+    reader.walk_key.assign(reader.key_size, 0);
+    reader.walk_next_key.assign(reader.key_size, 0);
+
+    reader.percpu = (info.type == BPF_MAP_TYPE_LRU_PERCPU_HASH ||
+                     info.type == BPF_MAP_TYPE_PERCPU_HASH);
+    if (reader.percpu) {
+        reader.num_cpus = libbpf_num_possible_cpus();
+        if (reader.num_cpus <= 0)
+            return -1;
+        reader.percpu_vals.assign(reader.num_cpus, traffic_val_t{});
+    }
+
+    reader.max_entries = info.max_entries;
+    reader.batch = use_batch;
+    if (reader.batch) {
+        reader.batch_keys.resize(static_cast<size_t>(reader.max_entries) * reader.key_size);
+        reader.batch_vals.resize(static_cast<size_t>(reader.max_entries) * reader.num_cpus);
+    }
+    return 0;
+}
+
+/**
+ * @brief Sum the per-CPU copies of one map value.
+ *
+ * `packets` and `bytes` are two adjacent __u64 words, so each CPU's pair is loaded as
+ * one 2-lane vector (SSE2 on x86, NEON on the Arm DPU) and two accumulators are kept
+ * to hide the add latency. `created_ns` is only set on the creating CPU's copy, so
+ * the maximum is taken.
+ */
+inline traffic_val_t sum_percpu_values(const traffic_val_t* vals, int num_cpus) {
+    typedef __u64 u64x2 __attribute__((vector_size(16)));
+    static_assert(offsetof(traffic_val_t, bytes) == offsetof(traffic_val_t, packets) + sizeof(__u64),
+                  "traffic_val_t must start with {packets, bytes}");
+
+    u64x2 acc0 = {0, 0}, acc1 = {0, 0};
+    __u64 created_ns = 0;
+    int c = 0;
+    for (; c + 1 < num_cpus; c += 2) {
+        u64x2 v0, v1;
+        std::memcpy(&v0, &vals[c].packets, sizeof(v0));
+        std::memcpy(&v1, &vals[c + 1].packets, sizeof(v1));
+        acc0 += v0;
+        acc1 += v1;
+        created_ns = std::max({created_ns, vals[c].created_ns, vals[c + 1].created_ns});
+    }
+    if (c < num_cpus) {
+        u64x2 v0;
+        std::memcpy(&v0, &vals[c].packets, sizeof(v0));
+        acc0 += v0;
+        created_ns = std::max(created_ns, vals[c].created_ns);
+    }
+    acc0 += acc1;
+
+    traffic_val_t sum{};
+    sum.packets = acc0[0];
+    sum.bytes = acc0[1];
+    sum.created_ns = created_ns;
+    return sum;
+}
+
+/**
+ * @brief Sort one map entry into the TCP or UDP snapshot.
  *
- * @param snapshot   Vector of cumulative values (e.g., bytes or packets).
- * @param last_seen  Reference to the last value seen before this snapshot.
- *                   Used to compute the first delta.
+ * @return bool  false if the entry has a protocol other than TCP or UDP.
+ */
+inline bool add_snapshot_entry(const traffic_key_t& key, const traffic_val_t& value,
+                     SnapshotBuffer<uint32_t>& snapshot) {
+    if (key.proto == IPPROTO_TCP) {
+        snapshot.tcp.push_back({ key.ip, value });
+    } else if (key.proto == IPPROTO_UDP) {
+        snapshot.udp.push_back({ key.ip, value });
+    } else {
+        char ip_str[INET_ADDRSTRLEN];
+        struct in_addr addr = { .s_addr = key.ip };
+        inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
+        std::cerr << "Warning: unsupported proto " << static_cast<int>(key.proto)
+                  << " for IP " << ip_str << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Sort one flow-keyed map entry into the TCP or UDP snapshot under its flow ID.
  *
- * @return A vector of deltas representing changes between adjacent snapshot values.
+ * @return bool  false if the entry has a protocol other than TCP or UDP.
  */
-std::vector<__u64> get_diff_vector(
-    const std::vector<__u64> snapshot, __u64& last_seen, size_t& valid_len) {
-    std::vector<__u64> diff;
-    valid_len = 0;
-    if (snapshot.empty()) return diff;
+inline bool add_flow_snapshot_entry(const traffic_flow_key_t& key, const traffic_val_t& value,
+                     SnapshotBuffer<uint32_t>& snapshot) {
+    if (key.proto != IPPROTO_TCP && key.proto != IPPROTO_UDP) {
+        std::cerr << "Warning: unsupported proto " << static_cast<int>(key.proto)
+                  << " for flow from " << key.saddr << std::endl;
+        return false;
+    }
 
-    /* Helper print
-    std::cout << "\t snapshot:";
-    for (size_t i = 0; i < snapshot.size(); i++) {
-        std::cout << snapshot[i] << ",";
+    uint32_t id = flows.intern(FlowTuple{ key.saddr, key.daddr, key.sport, key.dport });
+    (key.proto == IPPROTO_TCP ? snapshot.tcp : snapshot.udp).push_back({ id, value });
+    return true;
+}
+
+/**
+ * @brief Sort one raw map key of `reader.key_size` bytes into the TCP or UDP snapshot.
+ */
+inline bool add_map_entry(const MapReader&, const unsigned char* raw_key,
+                     const traffic_val_t& value,
+                     SnapshotBuffer<uint32_t>& snapshot) {
+    if (flow_keys) {
+        traffic_flow_key_t key;
+        std::memcpy(&key, raw_key, sizeof(key));
+        return add_flow_snapshot_entry(key, value, snapshot);
     }
-    std::cout << "\n\t last_seen=" << last_seen << std::endl;
-    */
+    traffic_key_t key;
+    std::memcpy(&key, raw_key, sizeof(key));
+    return add_snapshot_entry(key, value, snapshot);
+}
 
-    // snapshot is an array looks like [199, 199, ..., 200, 0, ...]
-    // It's non-decreasing until the zeros.
-
-    std::unique_lock lock(data_mutex);
-
-    // First element
-    if (snapshot[0] < last_seen) {
-        /// TODO: @test this senario can happen. When an IP was ejected from the
-        // map before and appears again, pre may be larger than snapshot[i].
-        /// TODO: @bug actually we do not know whether an IP has been ejected from
-        // the kernel map or not. last_seen has no information on that.
-        /// TODO: @bug Redesign, how to keep the kernel map and last_seen consistent.
-        std::cout << "[WARNING]\tNew entry?! curr=" << snapshot[0] << ", pre="\
-            << last_seen << ", i=0" << std::endl;
-        last_seen = snapshot[0];
-    }
-    diff.push_back(snapshot[0] - last_seen);
-    __u64 pre = snapshot[0];
-    valid_len = 1;
-    for (size_t i = 1; i < snapshot.size(); ++i) {
-        // Skip tailing zeros (because of extra memory allocation)
-        if (snapshot[i - 1] > 0 && snapshot[i] == 0)
-            break;
-        /// TODO: --verbose mode
-        if (snapshot[i] < pre) {
-            /// NOTE: We do have warnings when i is large!!!
-            /// It happens when reusing the ring buffer slot. Each round the real
-            //   bin numbers are different. If current round got less bins, then it will access
-            //   the data from previous run of the same buffer slot.
-            // std::cout << "[WARNING]\t [curr < pre?!] curr=" << snapshot[i] << ", pre="\
-            // << pre << ", i=" << i << ", last_seen=" << last_seen << std::endl;
-            last_seen = pre;
-            break;
+/**
+ * @brief Sort one raw IPv6 map key (`traffic_key6_t`) into the TCP or UDP snapshot.
+ */
+inline bool add_map_entry(const MapReader&, const unsigned char* raw_key,
+                     const traffic_val_t& value,
+                     SnapshotBuffer<Ip6Addr>& snapshot) {
+    traffic_key6_t key;
+    std::memcpy(&key, raw_key, sizeof(key));
+    Ip6Addr addr;
+    std::memcpy(addr.data(), key.ip6, addr.size());
+
+    if (key.proto == IPPROTO_TCP) {
+        snapshot.tcp.push_back({ addr, value });
+    } else if (key.proto == IPPROTO_UDP) {
+        snapshot.udp.push_back({ addr, value });
+    } else {
+        char ip_str[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, key.ip6, ip_str, sizeof(ip_str));
+        std::cerr << "Warning: unsupported proto " << static_cast<int>(key.proto)
+                  << " for IP " << ip_str << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the whole map with bpf_map_lookup_batch into the reader's preallocated buffers.
+ *
+ * With the buffers sized to `max_entries`, one syscall normally returns every entry.
+ *
+ * @return int  0 on success, -EOPNOTSUPP if the kernel/map has no batch ops
+ *              (nothing was read), or another negative errno on failure.
+ */
+template <typename Key>
+int get_snapshot_bpf_map_batch(MapReader& reader,
+                     SnapshotBuffer<Key>& snapshot,
+                     bool& has_unknown_proto) {
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    __u32 batch_token = 0;  // opaque bucket position for hash maps
+    void* in_batch = nullptr;
+    bool first = true;
+
+    while (true) {
+        __u32 count = reader.max_entries;
+        int err = bpf_map_lookup_batch(reader.fd, in_batch, &batch_token,
+            reader.batch_keys.data(), reader.batch_vals.data(), &count, &opts);
+        reader.last_syscalls += 1;
+        if (err < 0) err = -errno;  // libbpf < 1.0 returns -1 and sets errno
+
+        if (err < 0 && err != -ENOENT) {
+            if (first && (err == -EINVAL || err == -EOPNOTSUPP || err == -ENOTSUP || err == -524 /* ENOTSUPP */))
+                return -EOPNOTSUPP;
+            return err;
         }
-        diff.push_back(snapshot[i] - pre);
-        pre = snapshot[i];
-        valid_len += 1;
+
+        for (__u32 i = 0; i < count; ++i) {
+            const traffic_val_t* vals = &reader.batch_vals[static_cast<size_t>(i) * reader.num_cpus];
+            traffic_val_t value = reader.percpu ? sum_percpu_values(vals, reader.num_cpus) : vals[0];
+            const unsigned char* key = &reader.batch_keys[static_cast<size_t>(i) * reader.key_size];
+            if (!add_map_entry(reader, key, value, snapshot))
+                has_unknown_proto = true;
+        }
+
+        if (err == -ENOENT)  // no more entries
+            return 0;
+        in_batch = &batch_token;
+        first = false;
     }
-    last_seen = snapshot[valid_len - 1];
+}
 
-    /* Helper print
-    std::cout << "\t diff:";
-    for (size_t i = 0; i < diff.size(); i++) {
-        std::cout << diff[i] << ",";
+/**
+ * @brief Take a snapshot of an eBPF LRU hash map and separate entries into TCP and UDP.
+ *
+ * The map is read with bpf_map_lookup_batch when available. On kernels without batch
+ * ops the reader falls back, permanently, to the `bpf_map_get_next_key` plus
+ * `bpf_map_lookup_elem` walk (two syscalls per entry).
+ *
+ * If a protocol other than TCP or UDP is encountered, a warning is printed to `std::cerr`,
+ * and the function returns -1 to indicate that some unexpected entries were found.
+ *
+ * @param reader        Opened BPF map (BPF_MAP_TYPE_LRU_HASH or BPF_MAP_TYPE_LRU_PERCPU_HASH)
+ *                      to read from. Per-CPU values are summed into one `traffic_val_t`.
+ *                      `reader.last_syscalls` is set to the bpf() syscalls of this snapshot.
+ * @param snapshot      Output buffer of {IP, traffic_val_t} entries for TCP and UDP traffic,
+ *                      appended to; the caller clears it between polls.
+ *
+ * @return int  Returns 0 on success (only TCP/UDP entries encountered), or
+ *              -1 if any unsupported protocol entries were found in the map.
+ *
+ * @note The IP address is stored in networking byte order (big-endian) in the output buffer.
+ *       Flow-keyed maps are stored under their flow ID (see `FlowTable`), the IPv6 map
+ *       (Key = Ip6Addr) under the 128-bit address.
+ */
+template <typename Key>
+int get_snapshot_bpf_map(MapReader& reader,
+                     SnapshotBuffer<Key>& snapshot) {
+    unsigned char* key = reader.walk_key.data();
+    unsigned char* next_key = reader.walk_next_key.data();
+    const void* prev_key = nullptr;  // NULL returns the first key
+    traffic_val_t value{};
+    bool has_unknown_proto = false;
+    const int map_fd = reader.fd;
+    void* value_buf = reader.percpu ? static_cast<void*>(reader.percpu_vals.data()) : &value;
+
+    reader.last_syscalls = 0;
+    if (reader.batch) {
+        int err = get_snapshot_bpf_map_batch(reader, snapshot, has_unknown_proto);
+        if (err != -EOPNOTSUPP)
+            return (err == 0 && !has_unknown_proto) ? 0 : -1;
+
+        std::cerr << "Warning: bpf_map_lookup_batch not supported, falling back to the per-key walk"
+                  << std::endl;
+        reader.batch = false;
+        reader.batch_keys = {};
+        reader.batch_vals = {};
     }
-    std::cout << "\n\t valid_len=" << valid_len << std::endl;
-    std::cout << "\t last_seen=" << last_seen << std::endl;
-    */
 
-    bool all_zero = std::all_of(diff.begin(), diff.end(),
-                            [](auto v){ return v == 0; });
-    if (all_zero) {
-        valid_len = 0;
-        return {};
+    while (bpf_map_get_next_key(map_fd, prev_key, next_key) == 0) {
+        reader.last_syscalls += 1;
+        if (bpf_map_lookup_elem(map_fd, next_key, value_buf) == 0) {
+            if (reader.percpu)
+                value = sum_percpu_values(reader.percpu_vals.data(), reader.num_cpus);
+            if (!add_map_entry(reader, next_key, value, snapshot))
+                has_unknown_proto = true;
+        }
+        reader.last_syscalls += 1;
+        std::memcpy(key, next_key, reader.key_size);
+        prev_key = key;
     }
+    reader.last_syscalls += 1;  // the final get_next_key returning ENOENT
 
-    return diff;
+    return has_unknown_proto ? -1 : 0;
 }
 
+
 /**
- * @brief Update a single traffic metric field in the per-IP JSON record and
- *        advance the corresponding last-seen counter.
+ * @brief mmap one BPF_F_MMAPABLE array map read-only.
  *
- * This helper function encapsulates the common logic used for both TCP/UDP
- * byte and packet metrics. It computes per-interval differences between the
- * current snapshot (`snapshot`) and the previously recorded cumulative value
- * (`last_seen_val`), stores the resulting difference vector into the JSON
- * object (`j_ip`), and updates `last_seen_val` to the latest cumulative value.
+ * @return The mapping, or nullptr on failure. `len` is set to the mapped length.
+ */
+const void* mmap_bpf_array(int fd, const size_t value_size, size_t& len, __u32& max_entries) {
+    struct bpf_map_info info {};
+    __u32 info_len = sizeof(info);
+    if (bpf_obj_get_info_by_fd(fd, &info, &info_len) != 0)
+        return nullptr;
+    // The values are read in place as `value_size`-byte structs, e.g. a traffic_val_t of
+    // a kernel object built before `created_ns` would be misread.
+    if (info.type != BPF_MAP_TYPE_ARRAY || !(info.map_flags & BPF_F_MMAPABLE) || info.value_size != value_size) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    // Array values are laid out at 8-byte aligned strides.
+    size_t stride = (info.value_size + 7) & ~static_cast<size_t>(7);
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    len = (stride * info.max_entries + page - 1) / page * page;
+    max_entries = info.max_entries;
+
+    void* addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    return addr == MAP_FAILED ? nullptr : addr;
+}
+
+/**
+ * @brief Open and mmap the three maps of the -DTC_MMAP_COUNTERS layout.
  *
- * The function only updates the JSON and `last_seen_val` if at least one
- * valid (non-zero) element is found in the snapshot.
+ * The maps are expected to be pinned next to each other as `<base_path>_idx`,
+ * `<base_path>_ctr` and `<base_path>_key`.
  *
- * @param j_ip
- *        Reference to the per-IP JSON object being constructed.
- *        The function inserts a new key-value pair using `field_name`
- *        as the JSON field name.
+ * @return int  0 on success, or -1 if any map cannot be opened or mmapped.
+ */
+int open_mmap_reader(const std::string& base_path, MmapReader& reader) {
+    reader.idx_fd = bpf_obj_get((base_path + "_idx").c_str());
+    reader.ctr_fd = bpf_obj_get((base_path + "_ctr").c_str());
+    reader.key_fd = bpf_obj_get((base_path + "_key").c_str());
+    if (reader.idx_fd < 0 || reader.ctr_fd < 0 || reader.key_fd < 0)
+        return -1;
+
+    __u32 ctr_slots = 0, key_slots = 0;
+    reader.ctr = static_cast<const traffic_val_t*>(mmap_bpf_array(reader.ctr_fd, sizeof(traffic_val_t), reader.ctr_len, ctr_slots));
+    reader.keys = static_cast<const traffic_key_t*>(mmap_bpf_array(reader.key_fd, sizeof(traffic_key_t), reader.keys_len, key_slots));
+    if (!reader.ctr || !reader.keys)
+        return -1;
+
+    reader.max_slots = std::min(ctr_slots, key_slots);
+    reader.slot_keys.assign(reader.max_slots, traffic_key_t{});
+    return 0;
+}
+
+/**
+ * @brief Take a snapshot of the mmapped counter array and separate entries into TCP and UDP.
  *
- * @param field_name
- *        Name of the metric field (e.g., `"tcp_bytes"`, `"tcp_packets"`,
- *        `"udp_bytes"`, `"udp_packets"`).
+ * Counters are read with plain (relaxed atomic) loads. The only syscalls are one
+ * index-hash lookup per newly assigned slot, to confirm the slot's key once.
  *
- * @param snapshot
- *        Vector of cumulative counter values for the metric being updated.
- *        Typically taken from a `BinsPerIP` member (e.g., `bins.tcp_bytes`).
+ * @return int  0 on success, or -1 if any unsupported protocol entries were found.
+ */
+int get_snapshot_mmap(MmapReader& reader,
+                     SnapshotBuffer<uint32_t>& snapshot) {
+    bool has_unknown_proto = false;
+    reader.last_syscalls = 0;
+
+    // Learn the keys of the slots handed out since the last poll.
+    __u64 allocated = __atomic_load_n(&reader.ctr[TC_MMAP_HDR_SLOT].packets, __ATOMIC_ACQUIRE);
+    __u32 used_slots = static_cast<__u32>(std::min<__u64>(allocated + 1, reader.max_slots));
+    while (reader.known_slots < used_slots) {
+        __u32 slot = reader.known_slots;
+        traffic_key_t key;
+        std::memcpy(&key, &reader.keys[slot], sizeof(key));
+        if (key.ip == 0 || key.proto == 0)
+            break;  // the kernel has not written the key yet, retry next poll
+
+        __u32 owner = 0;
+        reader.last_syscalls += 1;
+        if (bpf_map_lookup_elem(reader.idx_fd, &key, &owner) == 0 && owner == slot) {
+            reader.slot_keys[slot] = key;
+        } else {
+            reader.slot_keys[slot] = traffic_key_t{};  // dead slot
+        }
+        reader.known_slots += 1;
+    }
+
+    for (__u32 slot = 1; slot < reader.known_slots; ++slot) {
+        const traffic_key_t& key = reader.slot_keys[slot];
+        if (key.proto == 0)
+            continue;
+        traffic_val_t value;
+        value.packets = __atomic_load_n(&reader.ctr[slot].packets, __ATOMIC_RELAXED);
+        value.bytes = __atomic_load_n(&reader.ctr[slot].bytes, __ATOMIC_RELAXED);
+        if (!add_snapshot_entry(key, value, snapshot))
+            has_unknown_proto = true;
+    }
+
+    return has_unknown_proto ? -1 : 0;
+}
+
+
+/**
+ * @brief Load a kernel ELF object and pin its program and maps next to `base_path`.
  *
- * @param last_seen_val
- *        Reference to the last cumulative value recorded for this metric
- *        and IP. The function updates this value in-place to the last
- *        non-zero snapshot entry processed.
+ * The counter map (the object's shortest map name, e.g. "map_in_tc") is pinned at
+ * `base_path` and every other map at `base_path` plus its name suffix, e.g. "map_in_tc_ovf"
+ * at `<base_path>_ovf`, so the readers find them as if pinned with bpftool. The program is
+ * pinned at `<base_path>_prog` for `tc ... bpf da object-pinned` or `ip link ... xdp pinned`.
  *
- * @note
- * - Calls `get_diff_vector()` internally to compute per-interval deltas.
- * - Does nothing if the snapshot vector is empty or contains only zeros.
- * - Designed for use within higher-level aggregation functions such as
- *   `print_in_json()`.
+ * With `max_entries` > 0 the LRU hash maps are resized before loading. The mmap and
+ * single-entry maps keep their compiled sizes, and so does the LRU map of the time-binned
+ * layout, whose 64 KiB values would make it take gigabytes of kernel memory.
+ *
+ * @return int  0 on success, or -1 on libbpf errors (e.g. stale pins of another size), or
+ *              with errno EINVAL when `max_entries` is set but no map of the object can take it.
  */
+int load_and_pin_object(const std::string& obj_path, const std::string& base_path, __u32 max_entries) {
+    struct bpf_object* obj = bpf_object__open_file(obj_path.c_str(), nullptr);
+    if (libbpf_get_error(obj))
+        return -1;
+    // The pins keep the program and maps alive after the object is closed.
+    std::unique_ptr<bpf_object, decltype(&bpf_object__close)> obj_guard(obj, bpf_object__close);
+
+    struct bpf_map* map;
+    std::string base_name;
+    bpf_object__for_each_map(map, obj) {
+        if (bpf_map__is_internal(map))
+            continue;
+        std::string name = bpf_map__name(map);
+        if (base_name.empty() || name.size() < base_name.size())
+            base_name = name;
+    }
+
+    size_t resized = 0;
+    bpf_object__for_each_map(map, obj) {
+        if (bpf_map__is_internal(map))
+            continue;
+        enum bpf_map_type type = bpf_map__type(map);
+        if (max_entries > 0 && (type == BPF_MAP_TYPE_LRU_HASH || type == BPF_MAP_TYPE_LRU_PERCPU_HASH)
+            && bpf_map__value_size(map) != sizeof(traffic_bins_t)) {
+            if (bpf_map__set_max_entries(map, max_entries) != 0)
+                return -1;
+            resized += 1;
+        }
+        std::string pin_path = base_path + std::string(bpf_map__name(map)).substr(base_name.size());
+        if (bpf_map__set_pin_path(map, pin_path.c_str()) != 0)
+            return -1;
+    }
 
-inline void update_metric_field(
-    json& j_ip,
-    const std::string& field_name,
-    const std::vector<__u64>& snapshot,
-    __u64& last_seen_val)
-{
-    if (snapshot.empty())
-        return;  // no data in this window
+    if (max_entries > 0 && resized == 0) {
+        std::cerr << "--max-entries: " << obj_path << " has no LRU hash map to resize"
+                  << " (the time-binned and mmap layouts keep their compiled sizes)" << std::endl;
+        errno = EINVAL;
+        return -1;
+    }
 
-    size_t valid_len = 0;
-    auto diff = get_diff_vector(snapshot, last_seen_val, valid_len);
+    if (bpf_object__load(obj) != 0)
+        return -1;
 
-    if (valid_len > 0) {
-        j_ip[field_name] = diff;
+    struct bpf_program* prog;
+    bpf_object__for_each_program(prog, obj) {
+        if (bpf_program__pin(prog, (base_path + "_prog").c_str()) != 0)
+            return -1;
     }
+    return 0;
 }
 
 /**
- * @brief Take a snapshot of an eBPF LRU hash map and separate entries into TCP and UDP maps.
+ * @brief Open the optional overflow counter `<base_path>_ovf`.
  *
- * If a protocol other than TCP or UDP is encountered, a warning is printed to `std::cerr`,
- * and the function returns -1 to indicate that some unexpected entries were found.
+ * @return int  0 on success, or -1 if it is not pinned (older kernel objects).
+ */
+int open_overflow_reader(const std::string& base_path, OverflowReader& reader) {
+    reader.fd = bpf_obj_get((base_path + "_ovf").c_str());
+    if (reader.fd < 0)
+        return -1;
+    reader.num_cpus = libbpf_num_possible_cpus();
+    if (reader.num_cpus <= 0)
+        return -1;
+    reader.percpu_vals.assign(reader.num_cpus, 0);
+    return 0;
+}
+
+/**
+ * @brief What the kernel program of the `layout` backend counts as an overflow, and the remedy.
+ */
+const char* overflow_meaning(const std::string& layout) {
+    static const std::pair<const char*, const char*> meanings[] = {
+        {"ringbuf", " records not emitted: ring buffer full, the packets are still counted"},
+        {"bins", " packets not counted: time-binned map full, raise TC_BINS_MAX_KEYS"},
+        {"mmap", " packets not counted: counter slots full, raise TC_MMAP_SLOTS"},
+    };
+    for (const auto& [name, what] : meanings) {
+        if (layout == name)
+            return what;
+    }
+    return " packets not counted: kernel map full, consider a larger --max-entries";
+}
+
+/**
+ * @brief Read the overflow counter and report the packets not counted in `print_second`.
  *
- * @param map_fd        File descriptor of the BPF map (BPF_MAP_TYPE_LRU_HASH) to read from.
- * @param snapshot_tcp  Output map storing {IP -> traffic_val_t} entries for TCP traffic.
- * @param snapshot_udp  Output map storing {IP -> traffic_val_t} entries for UDP traffic.
+ * Adds them to `stats` and warns on stderr when any were lost, with or without `-s`.
+ */
+void report_overflows(const time_t print_second, OverflowReader& reader) {
+    if (reader.fd < 0)
+        return;
+
+    __u32 zero_idx = 0;
+    if (bpf_map_lookup_elem(reader.fd, &zero_idx, reader.percpu_vals.data()) != 0)
+        return;
+    __u64 total = 0;
+    for (__u64 v : reader.percpu_vals)
+        total += v;
+    __u64 lost = total - reader.last_total;
+    reader.last_total = total;
+
+    stats.overflows += lost;
+    if (lost > 0) {
+        std::cerr << "[WARNING]\t[ " << print_second << "]\t " << lost << overflow_meaning(backend) << std::endl;
+    }
+}
+
+/**
+ * @brief Warn about the LRU evictions detected in `print_second`, with or without `-s`.
  *
- * @return int  Returns 0 on success (only TCP/UDP entries encountered), or
- *              -1 if any unsupported protocol entries were found in the map.
+ * The counters of an evicted key are rebased (`rebase_counters()`), but the packets it
+ * got between its last read and the eviction are lost.
+ */
+void report_evictions(const time_t print_second) {
+    const __u64 total = stats_reset.evictions + stats.evictions;
+    const __u64 evicted = total - evictions_reported;
+    evictions_reported = total;
+    if (evicted > 0) {
+        std::cerr << "[WARNING]\t[ " << print_second << "]\t " << evicted
+                  << " keys evicted from the kernel map and re-inserted, their last packets are lost" << std::endl;
+    }
+}
+
+/**
+ * @brief Forget the keys the kernel map has not returned for `KEY_EXPIRY_WINDOWS` polled windows.
+ *
+ * An LRU map drops idle keys silently; without this their incarnations, and the exporter's
+ * `last_seen` counters, would be kept for good. A key is expired when both its TCP and UDP
+ * entries are gone. It is handed to the exporter through `expired`, tagged with `second`, the
+ * window just handed over, and left in `keys`. A key that comes back later is new: its kernel
+ * entry counts from zero, and so does its first delta.
+ *
+ * Called by the poll thread of every loop once per window. A window without a successful
+ * poll (`polled` false) does not count as idle. The "ringbuf" loop only hears of active
+ * keys, so it passes `retain`: an idle key for which it returns true is still in the kernel
+ * map and is kept for another `KEY_EXPIRY_WINDOWS` windows.
+ */
+template <typename Key, typename Retain>
+void expire_idle_keys(IncarnationTable<Key>& table, ExpiredKeys<Key>& expired, const time_t second,
+    const bool polled, std::vector<Key>& keys, Retain retain) {
+    keys.clear();
+    if (!polled)
+        return;
+    auto age = [](std::map<Key, Incarnation>& m) {
+        for (auto& [key, inc] : m) {
+            inc.idle_windows = inc.seen ? 0 : inc.idle_windows + 1;
+            inc.seen = false;
+        }
+    };
+    auto idle = [](const std::map<Key, Incarnation>& m, const Key& key) {
+        auto it = m.find(key);
+        return it == m.end() || it->second.idle_windows >= KEY_EXPIRY_WINDOWS;
+    };
+    age(table.tcp);
+    age(table.udp);
+
+    for (const auto& [key, inc] : table.tcp) {
+        if (inc.idle_windows >= KEY_EXPIRY_WINDOWS && idle(table.udp, key))
+            keys.push_back(key);
+    }
+    for (const auto& [key, inc] : table.udp) {
+        if (inc.idle_windows >= KEY_EXPIRY_WINDOWS && table.tcp.find(key) == table.tcp.end())
+            keys.push_back(key);
+    }
+    keys.erase(std::remove_if(keys.begin(), keys.end(), [&](const Key& key) {
+        if (!retain(key))
+            return false;
+        for (auto* m : {&table.tcp, &table.udp}) {
+            auto it = m->find(key);
+            if (it != m->end())
+                it->second.idle_windows = 0;
+        }
+        return true;
+    }), keys.end());
+    if (keys.empty())
+        return;
+    for (const Key& key : keys) {
+        table.tcp.erase(key);
+        table.udp.erase(key);
+    }
+    expired.push(second, keys);
+}
+
+template <typename Key>
+void expire_idle_keys(IncarnationTable<Key>& table, ExpiredKeys<Key>& expired, const time_t second,
+    const bool polled, std::vector<Key>& keys) {
+    expire_idle_keys(table, expired, second, polled, keys, [](const Key&) { return false; });
+}
+
+/**
+ * @brief Return CLOCK_REALTIME - CLOCK_MONOTONIC in nanoseconds.
+ *
+ * `bpf_ktime_get_ns()` is CLOCK_MONOTONIC; adding this offset gives the wall-clock time.
+ */
+inline __s64 realtime_minus_monotonic_ns() {
+    struct timespec rt, mono;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return (static_cast<__s64>(rt.tv_sec) - mono.tv_sec) * 1000000000LL + (rt.tv_nsec - mono.tv_nsec);
+}
+
+/**
+ * @brief Open the time-binned map and set the kernel programs' bin width.
+ *
+ * The bin width must divide one second, and the kernel ring must hold at least two
+ * seconds of bins so that a full second can be drained while the next one is filling.
+ *
+ * @return int  0 on success, or -1 on an unusable bin width or map error.
+ */
+int open_time_bins_reader(const std::string& path, const __u64 width_ns, TimeBinsReader& reader) {
+    if (width_ns == 0 || 1000000000ULL % width_ns != 0 ||
+        2 * (1000000000ULL / width_ns) > TC_NUM_BINS) {
+        std::cerr << "Error, bin width " << width_ns << " ns must divide 1 s and leave >= 2 s in "
+                  << TC_NUM_BINS << " bins" << std::endl;
+        errno = EINVAL;
+        return -1;
+    }
+
+    reader.fd = bpf_obj_get(path.c_str());
+    reader.cfg_fd = bpf_obj_get((path + "_cfg").c_str());
+    if (reader.fd < 0 || reader.cfg_fd < 0)
+        return -1;
+
+    __u32 zero_idx = 0;
+    traffic_bin_cfg_t cfg{ width_ns };
+    if (bpf_map_update_elem(reader.cfg_fd, &zero_idx, &cfg, BPF_ANY) != 0)
+        return -1;
+
+    reader.bins_per_sec = static_cast<__u32>(1000000000ULL / width_ns);
+    reader.value = std::make_unique<traffic_bins_t>();
+    return 0;
+}
+
+/**
+ * @brief Drain the kernel bins of one wall-clock second into a window of the global ring buffer.
+ *
+ * Kernel bins are indexed by CLOCK_MONOTONIC (`bpf_ktime_get_ns()`); the second is mapped to
+ * the `bins_per_sec` consecutive bins starting at or after its first nanosecond. Every IP
+ * gets exactly `bins_per_sec` ticks, written as cumulative counters (running total plus
+ * prefix sum of the bins) so that `print_in_json()` treats them like polled snapshots.
+ *
+ * @return int  0 on success, or -1 if any unsupported protocol entries were found.
+ */
+int drain_time_bins(TimeBinsReader& reader, const time_t second, const int window_id) {
+    const __s64 realtime_minus_mono = realtime_minus_monotonic_ns();
+    const __u64 width = 1000000000ULL / reader.bins_per_sec;
+    const __s64 first_ns = static_cast<__s64>(second) * 1000000000LL - realtime_minus_mono;
+    const __u64 first_bin = (static_cast<__u64>(first_ns) + width - 1) / width;
+    const __u32 n = reader.bins_per_sec;
+
+    bool has_unknown_proto = false;
+    reader.last_syscalls = 0;
+    traffic_key_t key{}, next_key{};
+    const traffic_bins_t& value = *reader.value;
+
+    auto& curr_window = gBuffer[window_id];
+    if (curr_window.ticks() != n)
+        curr_window.init(n);
+    // A tick holds the counters up to the end of its kernel bin.
+    for (__u32 i = 0; i < n; ++i)
+        curr_window.tick_ns()[i] = (first_bin + i + 1) * width;
+
+    while (bpf_map_get_next_key(reader.fd, &key, &next_key) == 0) {
+        reader.last_syscalls += 2;
+        key = next_key;
+        if (bpf_map_lookup_elem(reader.fd, &next_key, reader.value.get()) != 0)
+            continue;
+
+        bool is_tcp = next_key.proto == IPPROTO_TCP;
+        if (!is_tcp && next_key.proto != IPPROTO_UDP) {
+            has_unknown_proto = true;
+            continue;
+        }
+
+        size_t row = curr_window.find_or_insert(next_key.ip);
+        __u64* out_bytes = curr_window.row(row, is_tcp ? TCP_BYTES : UDP_BYTES);
+        __u64* out_packets = curr_window.row(row, is_tcp ? TCP_PACKETS : UDP_PACKETS);
+        // Running total of the IP, so that the drained bins become cumulative counters
+        // like the snapshots of the other backends.
+        Incarnation& inc = (is_tcp ? incarnations.tcp : incarnations.udp)[next_key.ip];
+        inc.seen = true;
+        traffic_val_t& total = inc.last;
+
+        __u64 bytes = total.bytes, packets = total.packets;
+        for (__u32 i = 0; i < n; ++i) {
+            __u64 period = first_bin + i;
+            const traffic_bin_t& bin = value.bins[period & (TC_NUM_BINS - 1)];
+            if (bin.tag == static_cast<__u32>(period)) {
+                bytes += bin.bytes;
+                packets += bin.packets;
+            }
+            out_bytes[i] = bytes;
+            out_packets[i] = packets;
+        }
+        total.bytes = bytes;
+        total.packets = packets;
+    }
+    reader.last_syscalls += 1;  // the final get_next_key returning ENOENT
+
+    return has_unknown_proto ? -1 : 0;
+}
+
+
+/**
+ * @brief Rebase the counters of one key onto the counters of its previous kernel entries.
+ *
+ * When the kernel re-creates the entry of `key` (new `created_ns`), the counters of the
+ * old entry at its last read are added to every later value, so `val` stays a
+ * non-decreasing cumulative counter across evictions. Packets counted between the last
+ * read and the eviction are lost. Entries with `created_ns` 0 are never rebased.
+ *
+ * @return bool  true if an eviction was detected; it is also counted in `stats`.
+ */
+template <typename Key>
+bool rebase_counters(std::map<Key, Incarnation>& table, const Key& key, traffic_val_t& val) {
+    auto [it, inserted] = table.try_emplace(key);
+    Incarnation& inc = it->second;
+    bool evicted = !inserted && val.created_ns != inc.created_ns;
+    if (evicted) {
+        inc.base = inc.last;
+        stats.evictions += 1;
+    }
+    inc.seen = true;
+    inc.created_ns = val.created_ns;
+    val.packets += inc.base.packets;
+    val.bytes += inc.base.bytes;
+    inc.last = val;
+    return evicted;
+}
+
+/**
+ * @brief ring_buffer__poll() callback: place one summary record into the current window.
+ *
+ * The record's cumulative counters are written at the tick of its timestamp. Records of a
+ * finished second (consumed late) go to the first tick, records stamped ahead of the
+ * window roll go to the last tick. Gaps are forward-filled by `seal_ringbuf_window()`.
+ */
+int handle_traffic_event(void* ctx, void* data, size_t size) {
+    auto& reader = *static_cast<RingbufReader*>(ctx);
+    if (size < sizeof(traffic_event_t))
+        return 0;
+    traffic_event_t ev;
+    std::memcpy(&ev, data, sizeof(ev));
+    stats.events += 1;
+
+    bool is_tcp = ev.key.proto == IPPROTO_TCP;
+    if (!is_tcp && ev.key.proto != IPPROTO_UDP)
+        return 0;
+
+    rebase_counters(is_tcp ? incarnations.tcp : incarnations.udp, ev.key.ip, ev.val);
+    auto& latest = is_tcp ? reader.latest_tcp[ev.key.ip] : reader.latest_udp[ev.key.ip];
+    latest.packets = std::max(latest.packets, ev.val.packets);
+    latest.bytes = std::max(latest.bytes, ev.val.bytes);
+
+    __s64 wall_ns = static_cast<__s64>(ev.ts_ns) + reader.realtime_minus_mono;
+    __s64 window_start_ns = static_cast<__s64>(reader.window_second) * 1000000000LL;
+    __s64 offset_ns = std::clamp<__s64>(wall_ns - window_start_ns, 0, 999999999LL);
+    size_t tick = static_cast<size_t>(offset_ns * poll_hz / 1000000000LL);
+
+    if (!poller_owns(reader.window_id)) {
+        stats.busy_polls += 1;
+        return 0;
+    }
+    auto& curr_window = gBuffer[reader.window_id];
+    if (curr_window.ticks() != static_cast<size_t>(poll_hz))
+        curr_window.init(poll_hz);
+    size_t row = curr_window.find_or_insert(ev.key.ip);
+    __u64* out_bytes = curr_window.row(row, is_tcp ? TCP_BYTES : UDP_BYTES);
+    __u64* out_packets = curr_window.row(row, is_tcp ? TCP_PACKETS : UDP_PACKETS);
+    out_bytes[tick] = std::max(out_bytes[tick], ev.val.bytes);
+    out_packets[tick] = std::max(out_packets[tick], ev.val.packets);
+    return 0;
+}
+
+/**
+ * @brief Open the ring buffer, set the kernel emission thresholds and register the consumer.
+ *
+ * @return int  0 on success, or -1 on map or libbpf errors.
+ */
+int open_ringbuf_reader(const std::string& path, RingbufReader& reader) {
+    reader.map_fd = bpf_obj_get(path.c_str());
+    reader.rb_fd = bpf_obj_get((path + "_rb").c_str());
+    reader.cfg_fd = bpf_obj_get((path + "_cfg").c_str());
+    if (reader.map_fd < 0 || reader.rb_fd < 0 || reader.cfg_fd < 0)
+        return -1;
+
+    __u32 zero_idx = 0;
+    traffic_rb_cfg_t cfg{ emit_every_ns, emit_every_packets };
+    if (bpf_map_update_elem(reader.cfg_fd, &zero_idx, &cfg, BPF_ANY) != 0)
+        return -1;
+
+    reader.rb = ring_buffer__new(reader.rb_fd, handle_traffic_event, &reader, nullptr);
+    return reader.rb ? 0 : -1;
+}
+
+/**
+ * @brief Whether the kernel map still holds a TCP or UDP entry of `ip`.
+ *
+ * The ring buffer only carries the keys with traffic, so a key without records may be idle
+ * or dropped by the LRU map. An idle key must be kept: its next record continues the same
+ * counters. The syscall lookup does not refresh the key in the LRU.
+ */
+bool ringbuf_key_mapped(const RingbufReader& reader, const uint32_t ip) {
+    traffic_rb_state_t state;
+    for (const __u8 proto : {IPPROTO_TCP, IPPROTO_UDP}) {
+        traffic_key_t key{};
+        key.ip = ip;
+        key.proto = proto;
+        stats.syscalls += 1;
+        if (bpf_map_lookup_elem(reader.map_fd, &key, &state) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Forward-fill the cumulative counters of the finished ring-buffer window.
  *
- * @note The IP address is stored in networking byte order (big-endian) in the output maps.
+ * Ticks without a record hold the previous value, starting from the IP's value at the
+ * window start, so the window looks like a polled one to `print_in_json()`. A tick is
+ * stamped with the end of its 1/poll_hz slice of the second. A slot still held by the
+ * exporter is not touched, not even its rows; only the start values move on.
  */
-int get_snapshot_bpf_map(int map_fd,
-                     std::map<uint32_t, traffic_val_t>& snapshot_tcp,
-                     std::map<uint32_t, traffic_val_t>& snapshot_udp) {
-    traffic_key_t key{}, next_key{};
-    traffic_val_t value{};
-    bool has_unknown_proto = false;
+void seal_ringbuf_window(RingbufReader& reader) {
+    if (!poller_owns(reader.window_id)) {
+        reader.start_tcp = reader.latest_tcp;
+        reader.start_udp = reader.latest_udp;
+        return;
+    }
 
-    /// TODO: check if we can traverse faster by batching
-    while (bpf_map_get_next_key(map_fd, &key, &next_key) == 0) {
-        if (bpf_map_lookup_elem(map_fd, &next_key, &value) == 0) {
-            if (next_key.proto == IPPROTO_TCP) {
-                snapshot_tcp[next_key.ip] = value;
-            } else if (next_key.proto == IPPROTO_UDP) {
-                snapshot_udp[next_key.ip] = value;
-            } else {
-                has_unknown_proto = true;
-                char ip_str[INET_ADDRSTRLEN];
-                struct in_addr addr = { .s_addr = next_key.ip };
-                inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
-                std::cerr << "Warning: unsupported proto " << static_cast<int>(next_key.proto)
-                          << " for IP " << ip_str << std::endl;
-            }
+    auto forward_fill = [](__u64* vec, size_t n, __u64 carry) {
+        for (size_t i = 0; i < n; ++i) {
+            if (vec[i] < carry) vec[i] = carry;
+            else carry = vec[i];
         }
-        key = next_key;
+    };
+    auto start_of = [](const std::map<uint32_t, traffic_val_t>& start, uint32_t ip) {
+        auto it = start.find(ip);
+        return it == start.end() ? traffic_val_t{} : it->second;
+    };
+
+    auto& window = gBuffer[reader.window_id];
+    const size_t n = window.ticks();
+    const __s64 window_start_ns = static_cast<__s64>(reader.window_second) * 1000000000LL
+        - reader.realtime_minus_mono;
+    for (size_t i = 0; i < n; ++i)
+        window.tick_ns()[i] = window_start_ns + (i + 1) * 1000000000LL / poll_hz;
+    for (size_t r = 0; r < window.size(); ++r) {
+        traffic_val_t tcp = start_of(reader.start_tcp, window.key(r));
+        traffic_val_t udp = start_of(reader.start_udp, window.key(r));
+        forward_fill(window.row(r, TCP_BYTES), n, tcp.bytes);
+        forward_fill(window.row(r, TCP_PACKETS), n, tcp.packets);
+        forward_fill(window.row(r, UDP_BYTES), n, udp.bytes);
+        forward_fill(window.row(r, UDP_PACKETS), n, udp.packets);
     }
-
-    return has_unknown_proto ? -1 : 0;
+    reader.start_tcp = reader.latest_tcp;
+    reader.start_udp = reader.latest_udp;
 }
 
 
@@ -335,86 +1633,246 @@ int get_snapshot_bpf_map(int map_fd,
  *        time window within the global metric ring buffer.
  *
  * This function updates per-IP traffic metrics (bytes and packets) for a given
- * time window (`window_id`) and fine-grained polling tick (`polling_id`).
+ * time window (`window_id`) and fine-grained polling ticks (`first_id` to `polling_id`).
  * Each window in the global `gBuffer` corresponds to one slot of the ring buffer,
- * where each slot maps IPv4 addresses to their corresponding `BinsPerIP` data structure.
+ * where each slot maps IPv4 addresses to their row of a flat `WindowStore`.
  *
- * The function ensures thread safety by acquiring a mutex lock internally before
- * modifying the global data structure.
+ * The caller must own the slot, see `poller_owns()`; no lock is taken.
+ *
+ * @param ring
+ *        The global ring buffer of the address family, `gBuffer` or `gBuffer6`.
+ *
+ * @param incarnations
+ *        Kernel entry incarnations of the same address family, see `rebase_counters()`.
  *
  * @param window_id
  *        Index of the current time window within the global ring buffer
  *        (0 ≤ window_id < SLOTS_IN_GLOBAL_RING_BUFFER).
  *
+ * @param first_id
+ *        First tick the snapshot stands for, `polling_id` unless the poll loop missed
+ *        the deadlines of the ticks before it (see `PollScheduler`). The missed ticks
+ *        get the same values and sampling time, so their deltas are zero.
+ *
  * @param polling_id
  *        Index of the fine-grained time tick within the current window, indicating
  *        which position in the per-IP metric vectors will be updated.
- *        Must satisfy 0 ≤ polling_id < num_bins.
+ *        Must satisfy first_id ≤ polling_id < num_bins.
+ *
+ * @param tick_ns
+ *        CLOCK_MONOTONIC time the snapshot was taken at, stored for the ticks.
  *
  * @param num_bins
- *        Total number of bins per IP entry in a `BinsPerIP` instance. Used to
- *        initialize new `BinsPerIP` objects if the IP address is observed for
- *        the first time in the current window.
- *
- * @param snapshot_tcp
- *        Map of TCP traffic statistics, keyed by IPv4 address (in `uint32_t` form).
- *        Each value is a `traffic_val_t` structure containing `bytes` and `packets`
- *        fields, which are written to the corresponding TCP vectors in the
- *        `BinsPerIP` entry.
- *
- * @param snapshot_udp
- *        Map of UDP traffic statistics, keyed by IPv4 address (in `uint32_t` form).
- *        Each value is a `traffic_val_t` structure containing `bytes` and `packets`
- *        fields, which are written to the corresponding UDP vectors in the
- *        `BinsPerIP` entry.
+ *        Total number of bins (ticks) per IP row. The window is re-initialized if its
+ *        rows have a different length.
+ *
+ * @param snapshot
+ *        TCP and UDP entries of one poll, keyed by IPv4 address (in `uint32_t` form),
+ *        flow ID or Ip6Addr. Each value is a `traffic_val_t` structure containing
+ *        `bytes` and `packets` fields, which are written to the IP's TCP or UDP rows.
  *
  * @note
- * - This function acquires `data_mutex` internally to serialize access to `gBuffer`.
- * - If an IP entry does not exist in the target window, a new `BinsPerIP`
- *   instance is created and initialized with `num_bins` elements per vector.
- * - The function assumes that `polling_id` is within range for all initialized
- *   vectors; no bounds checking is performed for performance reasons.
- * - The function overwrites existing values at the given `polling_id` index
+ * - If an IP does not exist in the target window, it gets a zeroed row. No memory is
+ *   allocated unless the window holds more IPs than ever before.
+ * - Ticks at or beyond `num_bins` are dropped.
+ * - The function overwrites existing values at the given tick indices
  *   instead of accumulating them.
  */
+template <typename Key>
 void append_snapshot_to_metric_bins(
+    WindowRing<Key>& ring,
+    IncarnationTable<Key>& incarnations,
     const int window_id,
+    const uint32_t first_id,
     const uint32_t polling_id,
+    const __u64 tick_ns,
     const int num_bins,
-    // Map key: IP in integer
-    const std::map<uint32_t, traffic_val_t>& snapshot_tcp,
-    const std::map<uint32_t, traffic_val_t>& snapshot_udp) {
+    // Map key: IP in integer (or flow ID), or Ip6Addr
+    const SnapshotBuffer<Key>& snapshot) {
+
+    auto& curr_window = ring[window_id];
+    if (curr_window.ticks() != static_cast<size_t>(num_bins))
+        curr_window.init(num_bins);
+    if (polling_id >= curr_window.ticks() || first_id > polling_id)
+        return;
+    for (uint32_t t = first_id; t <= polling_id; ++t)
+        curr_window.tick_ns()[t] = tick_ns;
+
+    for (auto [ip, val] : snapshot.tcp) {
+        size_t row = curr_window.find_or_insert(ip);
+        rebase_counters(incarnations.tcp, ip, val);
+
+        __u64* bytes = curr_window.row(row, TCP_BYTES);
+        __u64* packets = curr_window.row(row, TCP_PACKETS);
+        for (uint32_t t = first_id; t <= polling_id; ++t) {
+            bytes[t] = val.bytes;
+            packets[t] = val.packets;
+        }
+    }
 
-    std::unique_lock lock(data_mutex);  // Protect global access
+    for (auto [ip, val] : snapshot.udp) {
+        size_t row = curr_window.find_or_insert(ip);
+        rebase_counters(incarnations.udp, ip, val);
 
-    auto& curr_window = gBuffer[window_id];
+        __u64* bytes = curr_window.row(row, UDP_BYTES);
+        __u64* packets = curr_window.row(row, UDP_PACKETS);
+        for (uint32_t t = first_id; t <= polling_id; ++t) {
+            bytes[t] = val.bytes;
+            packets[t] = val.packets;
+        }
+    }
+}
 
-    for (const auto& [ip, val] : snapshot_tcp) {
-        auto& bins = curr_window[ip];
 
-        // Initialize vectors if first time this IP appears
-        if (bins.tcp_bytes.empty()) {
-            /// NOTE: for large polling frequency, used bin number is smaller than num_bins
-            bins = BinsPerIP(num_bins);
+/**
+ * @brief Add the per-IP (or per-flow) rows of one window slot to `report`, then clear the slot.
+ *
+ * @param report     Report of the window's timestamp; gets one row per updated IP.
+ * @param window     Slot of `gBuffer` or `gBuffer6` to serialize.
+ * @param last_seen  Last-seen counters of the same address family, updated in-place.
+ * @param init_last_seen  Seed `last_seen` from the first bins (first report only).
+ * @param deltas     Delta buffer of the same address family; read by `report.write()`.
+ * @param tiers      Rollup tiers of the same address family, fed with the window's deltas.
+ * @param second     Second of the window.
+ * @param verbose    Helper print last_seen flag.
+ */
+template <typename Key>
+void append_window_report(ReportWriter& report, WindowStore<Key>& window, LastSeenMap<Key>& last_seen,
+    const bool init_last_seen, DeltaWindow& deltas, RollupTiers<Key>& tiers, const time_t second,
+    const bool verbose) {
+    // First-time initialization to avoid first data-point spike.
+    if (init_last_seen) {
+        for (size_t r = 0; r < window.size(); ++r) {
+            auto& seen = last_seen[window.key(r)];
+            seen.tcp_bytes = window.row(r, TCP_BYTES)[0];
+            seen.tcp_packets = window.row(r, TCP_PACKETS)[0];
+            seen.udp_bytes = window.row(r, UDP_BYTES)[0];
+            seen.udp_packets = window.row(r, UDP_PACKETS)[0];
         }
+    }
 
-        bins.tcp_bytes[polling_id] = val.bytes;
-        bins.tcp_packets[polling_id] = val.packets;
+    // Deltas of all rows and metrics in one pass, against the gathered last-seen values.
+    const size_t rows = window.size();
+    delta_seen_rows.resize(rows);
+    delta_last_seen.resize(rows * NUM_WINDOW_METRICS);
+    for (size_t r = 0; r < rows; ++r) {
+        LastSeen* seen = &last_seen[window.key(r)];
+        delta_seen_rows[r] = seen;
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            delta_last_seen[r * NUM_WINDOW_METRICS + m] = seen_field(*seen, static_cast<WindowMetric>(m));
     }
+    window_deltas(window, delta_last_seen.data(), deltas);
+
+    for (size_t r = 0; r < rows; ++r) {
+        const Key& ip = window.key(r);
+        auto& seen = *delta_seen_rows[r];
 
-    for (const auto& [ip, val] : snapshot_udp) {
-        auto& bins = curr_window[ip];
+        if (verbose) {
+            std::cout << "<before> last_seen[" << row_label(ip) << "] = (" << seen.tcp_bytes <<\
+            "[tcp_bytes], " << seen.udp_bytes << "[udp_bytes])" << std::endl;
+        }
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            const WindowMetric metric = static_cast<WindowMetric>(m);
+            /// NOTE: An IP evicted from the kernel map and re-inserted no longer lands here:
+            // its counters are rebased by `rebase_counters()` before they reach the bins.
+            // Entries without a creation time (mmap slots) are never evicted.
+            if (deltas.reset(r, metric)) {
+                std::cout << "[WARNING]\tNew entry?! curr=" << window.row(r, metric)[0] << ", pre="\
+                    << seen_field(seen, metric) << ", i=0" << std::endl;
+            }
+            seen_field(seen, metric) = delta_last_seen[r * NUM_WINDOW_METRICS + m];
+        }
+
+        if (tiers.sec.enabled() || tiers.min.enabled()) {
+            RollupCells cells;
+            bool has_traffic = false;
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                const WindowMetric metric = static_cast<WindowMetric>(m);
+                const __u64* d = deltas.row(r, metric);
+                for (size_t t = 0; t < deltas.valid_len(r, metric); ++t)
+                    cells[m].add(d[t]);
+                has_traffic |= !cells[m].empty();
+            }
+            if (has_traffic) {
+                tiers.sec.add(ip, second, cells);
+                tiers.min.add(ip, second, cells);
+            }
+        }
 
-        // Initialize vectors if first time this IP appears
-        if (bins.udp_bytes.empty()) {
-            bins = BinsPerIP(num_bins);
+        /// TODO: turn the debug information on for easier tracing
+        /// TODO: Use last_seen to caculate the coarse-grain window sum
+        if (verbose) {
+            std::cout << "[DEBUG] <after> last_seen[" << row_label(ip) << "] = (" << seen.tcp_bytes <<\
+            "[tcp_bytes], " << seen.udp_bytes << "[udp_bytes])" << std::endl;
         }
 
-        bins.udp_bytes[polling_id] = val.bytes;
-        bins.udp_packets[polling_id] = val.packets;
+        // Rows without any change are dropped by the report.
+        if (shm_ring.is_open()) {
+            shm_ring.add_row(binary_row_key(ip), deltas, r);
+        }
+        if (binary_writer.is_open()) {
+            binary_writer.add_row(binary_row_key(ip), deltas, r);
+        } else {
+            append_row_label(report.label_buf(), ip);
+            report.add_row(deltas, r);
+        }
     }
+
+    // Reset this slot in the ring buffer: drop its rows and zero their bins
+    window.clear();
+}
+
+/**
+ * @brief Print the rollup period starting at `start` of one tier (both address families)
+ *        as `{"<tier>": {"<start>": {"<ip>": {"tcp_bytes": {"sum": .., "max": .., "min": ..}, ...}}}}`.
+ *        Metrics without traffic in the period are left out.
+ */
+void print_rollup_period(const char* tier_name, const RollupTier<uint32_t>& tier,
+    const RollupTier<Ip6Addr>& tier6, const time_t start) {
+    json j_period;
+    auto add_key = [&j_period](const std::string& label, const RollupCells& cells) {
+        json j_ip;
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            if (!cells[m].empty())
+                j_ip[METRIC_NAMES[m]] = {{"sum", cells[m].sum}, {"max", cells[m].max}, {"min", cells[m].min}};
+        }
+        j_period[label] = j_ip;
+    };
+    tier.for_each_key(start, [&](const uint32_t& key, const RollupCells& cells) { add_key(row_label(key), cells); });
+    tier6.for_each_key(start, [&](const Ip6Addr& key, const RollupCells& cells) { add_key(row_label(key), cells); });
+    if (j_period.empty())
+        return;
+
+    json record;
+    record[tier_name][std::to_string(start)] = j_period;
+    std::cout << record.dump() << std::endl;
 }
 
+/**
+ * @brief Print the rollup periods finished by the window of `second`, exporter thread only.
+ *
+ * A period is finished by its last second, or by the first window of a later period
+ * when its last window was dropped by the export queue.
+ */
+void export_rollups(const time_t second) {
+    auto& pending = rollup_pending;
+    const char* names[2] = {"1s", "1m"};
+    const RollupTier<uint32_t>* tiers[2] = {&rollups.sec, &rollups.min};
+    const RollupTier<Ip6Addr>* tiers6[2] = {&rollups6.sec, &rollups6.min};
+
+    for (int i = 0; i < 2; ++i) {
+        if (!tiers[i]->enabled())
+            continue;
+        const time_t start = tiers[i]->period_of(second);
+        if (pending[i] >= 0 && pending[i] != start)
+            print_rollup_period(names[i], *tiers[i], *tiers6[i], pending[i]);
+        pending[i] = start;
+        if ((second + 1) % tiers[i]->period() == 0) {
+            print_rollup_period(names[i], *tiers[i], *tiers6[i], start);
+            pending[i] = -1;
+        }
+    }
+}
 
 /**
  * @brief Convert and print the per-IP traffic metrics of a specific window in JSON format.
@@ -423,21 +1881,26 @@ void append_snapshot_to_metric_bins(
  * ring buffer slot corresponding to `print_second` into a JSON record.
  * It compares each IP’s most recent counters against the last-seen values stored
  * in `last_seen` to compute per-interval deltas and outputs only updated entries.
+ * IPv4 rows come from `gBuffer`, IPv6 rows from `gBuffer6`, in the same record.
  *
  * The resulting JSON object is structured as:
  * ```
  * {
  *   "<timestamp>": {
- *     "<ip>": {
+ *     "<ip>": {           // "<saddr>:<sport>-<daddr>:<dport>" for flow-keyed maps,
+ *                         // the text form (e.g. "2001:db8::1") for IPv6
  *       "tcp_bytes": [...],
  *       "tcp_packets": [...],
  *       "udp_bytes": [...],
  *       "udp_packets": [...]
  *     },
  *     ...
+ *     "tick_ns": [...]    // "timestamps" export mode only
  *   }
  * }
  * ```
+ * In the "rates" export mode the metric vectors hold per-second rates, every delta divided
+ * by its measured tick duration (see `tick_durations()`), instead of the deltas.
  *
  * @param print_second
  *        The timestamp (in seconds) identifying the window to be printed.
@@ -447,77 +1910,559 @@ void append_snapshot_to_metric_bins(
  *        A reference to a map storing the last-seen per-IP counters from the
  *        previous print cycle. It is updated in-place with the latest counters
  *        after each call to track deltas between intervals.
+ * @param last_seen6
+ *        The same for the IPv6 rows.
  * @param verbose
  *        Helper print last_seen flag.
  *
  * @note
- * - The function accesses the global `gBuffer` to read per-IP bins.
+ * - The function reads the slot of `gBuffer` and `gBuffer6` published for `print_second`
+ *   (see `publish_window()`) and returns it to the poll thread once cleared.
  * - Only entries with nonzero changes since the previous print are included.
- * - Designed to be invoked asynchronously (e.g., via `std::thread(print_in_json, ...)`).
- * - The output is currently written to `stdout` in pretty-printed JSON form.
+ * - Called by the exporter thread only (`export_windows()`), which owns `last_seen`.
+ * - The record is serialized by `ReportWriter` (json_writer.h) without building a json
+ *   tree, byte-identical to the `dump()` of the same `nlohmann::json` record, and written
+ *   to `stdout` as one line.
+ * - With `--binary-out`, the window goes to `binary_writer` (tc_binary.h) instead, every
+ *   window including those without traffic; `tc_convert` turns it back into this JSON.
+ * - With `--shm-ring`, the window is also published to the shared-memory ring (shm_ring.h).
  */
-void print_in_json(
-    const time_t print_second, std::map<uint32_t, LastSeen>& last_seen, const bool verbose) {
-    json j_ts;
-
+void print_in_json(const time_t print_second, LastSeenMap<uint32_t>& last_seen,
+    LastSeenMap<Ip6Addr>& last_seen6, const bool verbose) {
     int window_id = print_second % SLOTS_IN_GLOBAL_RING_BUFFER;
-    // Note that not all time windows have exactly poll_hz values
-    // It may look like [9766, ..., 9766, 0, 0, 0]
+    // Polled windows have exactly poll_hz ticks (see `PollScheduler`); only a window whose
+    // end the poll loop overran looks like [9766, ..., 9766, 0, 0, 0]
+
+    // Both address families are stamped by the same polls; bins and ringbuf fill only IPv4.
+    // Read the stamps first, serializing clears the slot.
+    const WindowStore<uint32_t>& stamps = gBuffer[window_id];
+    std::vector<double> tick_dt_s;
+    if (export_mode == "rates")
+        tick_dt_s = tick_durations(stamps.tick_ns(), stamps.ticks(), last_tick_ns, 1.0 / window_ticks);
+    std::vector<__u64> tick_ns;
+    if (export_mode == "timestamps")
+        tick_ns.assign(stamps.tick_ns(), stamps.tick_ns() + stamps.ticks());
+    last_tick_ns = last_tick_of(stamps.tick_ns(), stamps.ticks(), last_tick_ns);
+
+    history.append(print_second, gBuffer[window_id]);
+    history6.append(print_second, gBuffer6[window_id]);
+
+    if (binary_writer.is_open())
+        binary_writer.begin_window(print_second, stamps.tick_ns(), stamps.ticks());
+    if (shm_ring.is_open())
+        shm_ring.begin_window(print_second, stamps.tick_ns(), stamps.ticks());
+    // Expire before adding, so a reused flow ID never merges into its old flow's series.
+    rollups.expire(print_second);
+    rollups6.expire(print_second);
+    report_writer.clear();
+    append_window_report(report_writer, gBuffer[window_id], last_seen, first_report,
+                         window_delta_buf, rollups, print_second, verbose);
+    append_window_report(report_writer, gBuffer6[window_id], last_seen6, first_report,
+                         window_delta_buf6, rollups6, print_second, verbose);
+    first_report = false;
+    return_window(window_id);
+
+    if (binary_writer.is_open() && binary_writer.end_window() != 0) {
+        std::cout << "[WARNING]\tFailed to write the binary export: " << strerror(errno)\
+            << ", " << binary_writer.dropped_windows() << " windows dropped so far" << std::endl;
+    }
+    if (shm_ring.is_open() && !shm_ring.end_window()) {
+        std::cout << "[WARNING]\tWindow " << print_second << " does not fit in the shared-memory ring"\
+            << ", raise --shm-mb" << std::endl;
+    }
+    if (!report_writer.empty()) {
+        const std::string& text = report_writer.write(print_second,
+            tick_dt_s.empty() ? nullptr : tick_dt_s.data(),
+            tick_ns.empty() ? nullptr : tick_ns.data(), tick_ns.size());
+
+        /// TODO: not dump to screen
+        std::cout.write(text.data(), text.size());
+        std::cout << std::endl;
+    }
+    if (rollup_export) {
+        export_rollups(print_second);
+    }
+}
 
-    // First-time initialization to avoid first data-point spike.
-    if (first_report) {
-        for (const auto& [ip, bins] : gBuffer[window_id]) {
-            last_seen[ip].tcp_bytes = bins.tcp_bytes.front();
-            last_seen[ip].tcp_packets = bins.tcp_packets.front();
-            last_seen[ip].udp_bytes = bins.udp_bytes.front();
-            last_seen[ip].udp_packets = bins.udp_packets.front();
+
+/**
+ * @brief Pin the calling thread to `cpu`; a failure is only a warning.
+ */
+void pin_current_thread(const int cpu, const char* name) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0)
+        std::cerr << "Warning: cannot pin the " << name << " to CPU " << cpu << ": " << strerror(err) << std::endl;
+}
+
+/**
+ * @brief Store the run totals of `stats` in `health` for the metrics endpoint.
+ */
+void publish_health() {
+    constexpr auto relaxed = std::memory_order_relaxed;
+    health.polls.store(stats_reset.polls + stats.polls, relaxed);
+    health.missed_ticks.store(stats_reset.missed_ticks + stats.missed_ticks, relaxed);
+    health.busy_polls.store(stats_reset.busy_polls + stats.busy_polls, relaxed);
+    health.overflows.store(stats_reset.overflows + stats.overflows, relaxed);
+    health.evictions.store(stats_reset.evictions + stats.evictions, relaxed);
+    health.export_dropped.store(stats_reset.export_dropped + stats.export_dropped, relaxed);
+    health.export_queue.store(stats.export_queue, relaxed);
+}
+
+/**
+ * @brief Publish the finished window of `second` and queue it for the exporter thread.
+ *
+ * With the "drop-oldest" policy a full queue gives its oldest window back to the poll
+ * thread unexported. Its rows are cleared; since the bins are cumulative counters, the
+ * dropped second's traffic shows up in the first tick of the next exported window.
+ */
+void hand_to_exporter(ExportQueue& queue, const time_t second) {
+    int window_id = second % SLOTS_IN_GLOBAL_RING_BUFFER;
+    if (!poller_owns(window_id))
+        return;     // the poll thread never wrote this second, see `CollectorStats::busy_polls`
+    publish_window(window_id);
+
+    ExportItem dropped{};
+    if (queue.push(ExportItem{second, window_id}, export_policy == "block", dropped)) {
+        gBuffer[dropped.window_id].clear();
+        gBuffer6[dropped.window_id].clear();
+        return_window(dropped.window_id);
+        stats.export_dropped += 1;
+        std::cerr << "[WARNING]\tExporter behind, dropped the window of " << dropped.second << std::endl;
+    }
+    stats.export_queue = queue.depth();
+    if (metrics_port != 0) {
+        publish_health();
+    }
+}
+
+// Samples `<name>_total{<label>="<key>",proto="tcp|udp"}` of the keys of one address family.
+template <typename Key>
+void append_key_samples(OpenMetricsWriter& om, const char* name, const LastSeenMap<Key>& last_seen,
+    const char* label, __u64 LastSeen::*tcp, __u64 LastSeen::*udp, std::string& labels) {
+    for (const auto& [key, seen] : last_seen) {
+        labels.assign(label).append("=\"");
+        append_row_label(labels, key);
+        const size_t key_len = labels.size();
+        labels.append("\",proto=\"tcp\"");
+        om.sample(name, "_total", labels, seen.*tcp);
+        labels.resize(key_len);
+        labels.append("\",proto=\"udp\"");
+        om.sample(name, "_total", labels, seen.*udp);
+    }
+}
+
+/**
+ * @brief Render the OpenMetrics exposition after the window of `second` and hand it to
+ *        `metrics_server`, which serves it until the next window.
+ *
+ * - Called by the exporter thread only, so scrapes never reach the poll thread.
+ * - The per-IP (per-flow) counters are the cumulative `last_seen` counters, labelled like
+ *   the rows of the JSON report; the health counters are the totals in `health`.
+ */
+void render_metrics(const time_t second, const __u64 exported,
+    const LastSeenMap<uint32_t>& last_seen, const LastSeenMap<Ip6Addr>& last_seen6) {
+    constexpr auto relaxed = std::memory_order_relaxed;
+    // A fresh string every window: the server keeps serving the previous one while this
+    // one is rendered, and takes it over without a copy.
+    std::string text, labels;
+    text.reserve(metrics_text_bytes);
+    OpenMetricsWriter om(text);
+
+    const char* label = flow_keys ? "flow" : "ip";
+    om.family("tc_bytes", "counter", "Bytes counted by the kernel program.");
+    append_key_samples(om, "tc_bytes", last_seen, label, &LastSeen::tcp_bytes, &LastSeen::udp_bytes, labels);
+    append_key_samples(om, "tc_bytes", last_seen6, "ip", &LastSeen::tcp_bytes, &LastSeen::udp_bytes, labels);
+    om.family("tc_packets", "counter", "Packets counted by the kernel program.");
+    append_key_samples(om, "tc_packets", last_seen, label, &LastSeen::tcp_packets, &LastSeen::udp_packets, labels);
+    append_key_samples(om, "tc_packets", last_seen6, "ip", &LastSeen::tcp_packets, &LastSeen::udp_packets, labels);
+
+    om.family("tc_tracked_keys", "gauge", "IPs (or flows) with counters.");
+    om.sample("tc_tracked_keys", "", "", last_seen.size() + last_seen6.size());
+    om.family("tc_kernel_overflows", "counter", "Packets the kernel program could not count.");
+    om.sample("tc_kernel_overflows", "_total", "", health.overflows.load(relaxed));
+    om.family("tc_evictions", "counter", "Keys evicted from the kernel LRU map and re-inserted.");
+    om.sample("tc_evictions", "_total", "", health.evictions.load(relaxed));
+    om.family("tc_polls", "counter", "Polls of the BPF map.");
+    om.sample("tc_polls", "_total", "", health.polls.load(relaxed));
+    om.family("tc_missed_ticks", "counter", "Poll deadlines passed before the poll loop got to them.");
+    om.sample("tc_missed_ticks", "_total", "", health.missed_ticks.load(relaxed));
+    om.family("tc_busy_polls", "counter", "Polls dropped, their window still held by the exporter.");
+    om.sample("tc_busy_polls", "_total", "", health.busy_polls.load(relaxed));
+    om.family("tc_exported_windows", "counter", "Windows exported.");
+    om.sample("tc_exported_windows", "_total", "", exported);
+    om.family("tc_dropped_windows", "counter", "Windows dropped by the drop-oldest export policy.");
+    om.sample("tc_dropped_windows", "_total", "", health.export_dropped.load(relaxed));
+    om.family("tc_export_queue_windows", "gauge", "Windows waiting for the exporter.");
+    om.sample("tc_export_queue_windows", "", "", health.export_queue.load(relaxed));
+    om.family("tc_last_window_timestamp_seconds", "gauge", "Second of the last exported window.");
+    om.sample("tc_last_window_timestamp_seconds", "", "", static_cast<uint64_t>(second));
+    om.eof();
+    metrics_text_bytes = text.size();
+    metrics_server.publish(std::move(text));
+}
+
+/**
+ * @brief Seconds a retired flow ID stays reserved after its `last_seen` is dropped: the
+ *        history and the rollup tiers may still hold windows or periods of the old flow.
+ */
+time_t flow_id_hold_sec() {
+    time_t hold = history_sec;
+    if (rollup_1s_slots > 0)
+        hold = std::max<time_t>(hold, static_cast<time_t>(rollup_1s_slots) + 1);
+    if (rollup_1m_slots > 0)
+        hold = std::max<time_t>(hold, (static_cast<time_t>(rollup_1m_slots) + 1) * 60);
+    return hold;
+}
+
+/**
+ * @brief Drop the `last_seen` counters of the keys expired before the window of `second`,
+ *        exporter thread only. Called before the window is exported, so a key that came
+ *        back in it is counted from zero.
+ *
+ * Expired flow IDs are released to `flows` for reuse `flow_id_hold_sec()` later.
+ */
+void drop_expired_keys(const time_t second, LastSeenMap<uint32_t>& last_seen, LastSeenMap<Ip6Addr>& last_seen6) {
+    std::vector<uint32_t> keys;     // allocates only when keys expired
+    std::vector<Ip6Addr> keys6;
+    expired_keys.take(second, keys);
+    expired_keys6.take(second, keys6);
+    for (const uint32_t& key : keys)
+        last_seen.erase(key);
+    for (const Ip6Addr& key : keys6)
+        last_seen6.erase(key);
+
+    if (!flow_keys)
+        return;
+    const time_t release_at = second + flow_id_hold_sec();
+    for (const uint32_t id : keys)
+        held_flow_ids.emplace_back(release_at, id);
+    while (!held_flow_ids.empty() && held_flow_ids.front().first <= second) {
+        flows.release(held_flow_ids.front().second);
+        held_flow_ids.pop_front();
+    }
+}
+
+/**
+ * @brief Body of the exporter thread: serialize the queued windows until `queue` is stopped.
+ *
+ * One long-lived thread, so `last_seen` and `first_report` have a single writer and
+ * windows are printed in order.
+ */
+void export_windows(ExportQueue& queue, const bool verbose) {
+    if (export_cpu >= 0) {
+        pin_current_thread(export_cpu, "exporter");
+    }
+
+    LastSeenMap<uint32_t> last_seen;
+    LastSeenMap<Ip6Addr> last_seen6;
+    ExportItem item;
+    __u64 exported = 0;
+    while (queue.pop(item)) {
+        drop_expired_keys(item.second, last_seen, last_seen6);
+        print_in_json(item.second, last_seen, last_seen6, verbose);
+        exported += 1;
+        if (metrics_server.running()) {
+            render_metrics(item.second, exported, last_seen, last_seen6);
         }
-        first_report = false;
     }
+}
+
+
+/**
+ * @brief Print the collector self-telemetry of the finished window to `stderr` and reset it.
+ *
+ * Written to `stderr` so that the JSON report on `stdout` keeps its format.
+ */
+void print_collector_stats(const time_t print_second, const std::string& read_path) {
+    double syscalls_per_snapshot = stats.polls ? static_cast<double>(stats.syscalls) / stats.polls : 0.0;
+    std::cerr << "[STATS] " << print_second
+              << " polls=" << stats.polls
+              << " read_path=" << read_path
+              << " syscalls=" << stats.syscalls
+              << " syscalls_per_snapshot=" << std::fixed << std::setprecision(1) << syscalls_per_snapshot
+              << std::defaultfloat;
+#ifdef TC_COUNT_ALLOCS
+    std::cerr << " allocs_per_poll=" << std::fixed << std::setprecision(1)
+              << (stats.polls ? static_cast<double>(stats.allocs) / stats.polls : 0.0) << std::defaultfloat;
+#endif
+    if (read_path == "ringbuf") {
+        std::cerr << " events=" << stats.events;
+    }
+    if (read_path != "mmap" && read_path != "bins") {
+        std::cerr << " evictions=" << stats.evictions;
+    }
+    if (overflow.fd >= 0) {
+        std::cerr << " overflows=" << stats.overflows;
+    }
+    if (stats.busy_polls) {
+        std::cerr << " busy_polls=" << stats.busy_polls;
+    }
+    if (read_path != "bins" && read_path != "ringbuf") {
+        std::cerr << " missed_ticks=" << stats.missed_ticks << std::fixed << std::setprecision(1)
+                  << " jitter_p50_us=" << stats.jitter.quantile(0.5) / 1000.0
+                  << " jitter_p99_us=" << stats.jitter.quantile(0.99) / 1000.0
+                  << " jitter_max_us=" << stats.jitter.max_ns / 1000.0 << std::defaultfloat;
+    }
+    std::cerr << " export_queue=" << stats.export_queue
+              << " export_dropped=" << stats.export_dropped;
+    if (flow_keys) {
+        std::cerr << " flow_ids=" << flows.size();
+    }
+    std::cerr << std::endl;
+    stats_reset.polls += stats.polls;
+    stats_reset.missed_ticks += stats.missed_ticks;
+    stats_reset.busy_polls += stats.busy_polls;
+    stats_reset.overflows += stats.overflows;
+    stats_reset.evictions += stats.evictions;
+    stats_reset.export_dropped += stats.export_dropped;
+    stats = CollectorStats{};
+}
 
-    // std::unique_lock lock(data_mutex);
-    for (const auto& [ip, bins] : gBuffer[window_id]) {
-        json j_ip;
 
-        if (verbose) {
-            std::cout << "<before> last_seen[" << ip << "] = (" << last_seen[ip].tcp_bytes <<\
-            "[tcp_bytes], " << last_seen[ip].udp_bytes << "[udp_bytes])" << std::endl;
+/**
+ * @brief Hint the CPU that the thread is spinning: `pause` on x86, `yield` on Arm.
+ */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+/**
+ * @brief Move the calling (poll) thread to SCHED_FIFO with priority `prio`; a failure
+ *        (no CAP_SYS_NICE) is only a warning.
+ */
+void set_fifo_priority(const int prio) {
+    struct sched_param param{};
+    param.sched_priority = prio;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0)
+        std::cerr << "Warning: cannot set SCHED_FIFO priority " << prio << ": " << strerror(err) << std::endl;
+}
+
+/**
+ * @brief Print the size of the compressed window history to `stderr`.
+ */
+void print_history_summary() {
+    std::cerr << "[HISTORY] windows=" << history.num_windows() << " bytes=" << history.memory_bytes()
+              << " windows6=" << history6.num_windows() << " bytes6=" << history6.memory_bytes() << std::endl;
+}
+
+/**
+ * @brief Print the wakeup lateness of the poll loop over the whole run to `stderr`.
+ */
+void print_jitter_summary() {
+    const JitterHistogram& h = jitter_total;
+    std::cerr << "[JITTER] wait=" << wait_mode << " ticks=" << h.total << std::fixed << std::setprecision(1)
+              << " p50_us=" << h.quantile(0.5) / 1000.0
+              << " p90_us=" << h.quantile(0.9) / 1000.0
+              << " p99_us=" << h.quantile(0.99) / 1000.0
+              << " p999_us=" << h.quantile(0.999) / 1000.0
+              << " max_us=" << h.max_ns / 1000.0 << std::defaultfloat << std::endl;
+}
+
+// ++ How `PollScheduler::wait()` waits for a deadline, parsed once from `wait_mode`
+enum WaitMode {
+    WAIT_SLEEP,
+    WAIT_SPIN,
+    WAIT_HYBRID,
+};
+
+/**
+ * @brief Absolute-deadline schedule of the "hash" and "mmap" poll loop.
+ *
+ * Tick k of second S is due at S + ceil(k / hz) on CLOCK_REALTIME, the clock the windows
+ * are keyed by, and the loop sleeps until that deadline with `clock_nanosleep(TIMER_ABSTIME)`.
+ * The loop's own run time therefore never shifts later ticks, any `hz` works (3000 Hz,
+ * not only divisors of 1,000,000) and every window gets exactly `hz` ticks.
+ *
+ * A poll that wakes after the deadline of the following tick stands for all the ticks
+ * due by then; the ticks it skips are counted as missed. Only an overrun across the end
+ * of a second leaves the window's remaining ticks empty.
+ *
+ * `wait_mode` trades CPU for wakeup latency: "sleep" only sleeps, "spin" reads the clock
+ * in a loop with a CPU relax hint, "hybrid" sleeps until `spin_ns` before the deadline
+ * and spins the rest. The lateness of every wakeup is kept in `late_ns`.
+ */
+struct PollScheduler {
+    static constexpr __u64 NS_PER_SEC = 1000000000ULL;
+
+    __u64 hz = 0;
+    time_t second = 0;      // window of the next tick
+    __u64 tick = 0;         // index of the next tick in `second`
+    __u64 late_ns = 0;      // wakeup lateness of the last `wait()`
+    const WaitMode mode;
+
+    explicit PollScheduler(const __u64 poll_hz)
+        : hz(poll_hz),
+          mode(wait_mode == "spin" ? WAIT_SPIN : wait_mode == "hybrid" ? WAIT_HYBRID : WAIT_SLEEP) {
+        __u64 now = realtime_ns();
+        second = static_cast<time_t>(now / NS_PER_SEC);
+        tick = ((now % NS_PER_SEC) * hz + NS_PER_SEC - 1) / NS_PER_SEC;
+        if (tick == hz) {
+            second += 1;
+            tick = 0;
         }
+    }
 
-        update_metric_field(j_ip, "tcp_bytes",   bins.tcp_bytes,   last_seen[ip].tcp_bytes);
-        update_metric_field(j_ip, "tcp_packets", bins.tcp_packets, last_seen[ip].tcp_packets);
-        update_metric_field(j_ip, "udp_bytes",   bins.udp_bytes,   last_seen[ip].udp_bytes);
-        update_metric_field(j_ip, "udp_packets", bins.udp_packets, last_seen[ip].udp_packets);
+    __u64 deadline_ns(const time_t s, const __u64 k) const {
+        return static_cast<__u64>(s) * NS_PER_SEC + (k * NS_PER_SEC + hz - 1) / hz;
+    }
 
-        /// TODO: turn the debug information on for easier tracing
-        /// TODO: Use last_seen to caculate the coarse-grain window sum
-        if (verbose) {
-            std::cout << "[DEBUG] <after> last_seen[" << ip << "] = (" << last_seen[ip].tcp_bytes <<\
-            "[tcp_bytes], " << last_seen[ip].udp_bytes << "[udp_bytes])" << std::endl;
+    /**
+     * @brief Sleep until the next deadline, then return the window and the range of ticks
+     *        [`first`, `last`] the coming poll stands for.
+     *
+     * @return __u64  number of deadlines missed since the previous poll.
+     */
+    __u64 wait(time_t& window_second, uint32_t& first, uint32_t& last) {
+        __u64 due = deadline_ns(second, tick);
+        if (mode != WAIT_SPIN) {
+            __u64 wake = (mode == WAIT_HYBRID && due > spin_ns) ? due - spin_ns : due;
+            struct timespec ts;
+            ts.tv_sec = static_cast<time_t>(wake / NS_PER_SEC);
+            ts.tv_nsec = static_cast<long>(wake % NS_PER_SEC);
+            while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, nullptr) == EINTR && running) {}
+        }
+        __u64 now = realtime_ns();
+        while (now < due && running) {
+            cpu_relax();
+            now = realtime_ns();
         }
+        late_ns = now > due ? now - due : 0;
+
+        now = std::max(now, due);
+        time_t now_second = static_cast<time_t>(now / NS_PER_SEC);
+        __u64 now_tick = (now % NS_PER_SEC) * hz / NS_PER_SEC;    // latest tick due by now
+        __u64 missed = 0;
+        if (now_second != second) {
+            // Overran the end of the window: its remaining ticks and whole seconds are lost.
+            missed += (hz - tick) + static_cast<__u64>(now_second - second - 1) * hz;
+            second = now_second;
+            tick = 0;
+        }
+        missed += now_tick - tick;
+
+        window_second = second;
+        first = static_cast<uint32_t>(tick);
+        last = static_cast<uint32_t>(now_tick);
+        tick = now_tick + 1;
+        if (tick == hz) {
+            second += 1;
+            tick = 0;
+        }
+        return missed;
+    }
+};
 
-        if (j_ip.empty())
+
+/**
+ * @brief Main loop of the "bins" backend: drain one full second of kernel bins at 1 Hz.
+ *
+ * Wakes up shortly after every wall-clock second, so that packets stamped in the
+ * finished second have been counted, then hands the window to the exporter thread.
+ */
+void poll_time_bins(TimeBinsReader& reader, ExportQueue& export_queue, const bool verbose) {
+    const auto drain_delay = std::chrono::milliseconds(5);
+    std::vector<uint32_t> expired;
+    while (running) {
+        auto next_second = std::chrono::time_point_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now()) + std::chrono::seconds(1);
+        std::this_thread::sleep_until(next_second + drain_delay);
+
+        time_t second = std::chrono::system_clock::to_time_t(next_second) - 1;
+        int window_id = second % SLOTS_IN_GLOBAL_RING_BUFFER;
+        if (!poller_owns(window_id)) {
+            stats.busy_polls += 1;
             continue;
+        }
+        const __u64 allocs_before = thread_allocs;
+        drain_time_bins(reader, second, window_id);
+        stats.allocs += thread_allocs - allocs_before;
+        stats.polls += 1;
+        stats.syscalls += reader.last_syscalls;
 
-        /// TODO: update this to include a (src, dst) pair
-        j_ts[std::to_string(ip)] = j_ip;
+        if (verbose) {
+            std::cout << "[INFO]\t[ " << second << "]\t Drained " << reader.bins_per_sec\
+                << " bins, syscalls = " << reader.last_syscalls << std::endl;
+        }
+        report_overflows(second, overflow);
+        hand_to_exporter(export_queue, second);
+        // A drain walks every key of the map, so a key missing for long was dropped by the kernel.
+        expire_idle_keys(incarnations, expired_keys, second, true, expired);
+        if (print_stats) {
+            print_collector_stats(second, "bins");
+        }
     }
+}
 
-    // Reset this slot in the ring buffer to zeros
-    for (auto& [ip, bins] : gBuffer[window_id]) {
-        std::fill(bins.tcp_bytes.begin(),     bins.tcp_bytes.end(), 0);
-        std::fill(bins.tcp_packets.begin(),   bins.tcp_packets.end(), 0);
-        std::fill(bins.udp_bytes.begin(),     bins.udp_bytes.end(), 0);
-        std::fill(bins.udp_packets.begin(),   bins.udp_packets.end(), 0);
-    }
-    if (j_ts.empty())
-        return;
 
-    json record;
-    record[std::to_string(print_second)] = j_ts;
+/**
+ * @brief Main loop of the "ringbuf" backend: sleep in epoll until records arrive.
+ *
+ * `ring_buffer__poll()` waits on the ring buffer's epoll fd with a timeout set to the next
+ * wall-clock second, so wakeups follow the traffic and idle IPs cost nothing. At every
+ * second the pending records are consumed, the window is sealed and handed to the exporter thread.
+ */
+void poll_ringbuf(RingbufReader& reader, ExportQueue& export_queue, const bool verbose) {
+    std::vector<uint32_t> expired;
+    reader.window_second = now_sec();
+    reader.window_id = reader.window_second % SLOTS_IN_GLOBAL_RING_BUFFER;
+    reader.realtime_minus_mono = realtime_minus_monotonic_ns();
 
-    /// TODO: not dump to screen
-    std::cout << record.dump() << std::endl;
+    while (running) {
+        auto now = std::chrono::system_clock::now();
+        auto next_second = std::chrono::time_point_cast<std::chrono::seconds>(now) + std::chrono::seconds(1);
+        int timeout_ms = static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(next_second - now).count()) + 1;
+
+        const __u64 allocs_before = thread_allocs;
+        int err = ring_buffer__poll(reader.rb, timeout_ms);
+        stats.allocs += thread_allocs - allocs_before;
+        stats.polls += 1;
+        stats.syscalls += 1;
+        if (err < 0 && err != -EINTR) {
+            std::cerr << "Error polling the ring buffer: " << err << std::endl;
+            break;
+        }
+
+        time_t curr_second = now_sec();
+        if (curr_second == reader.window_second)
+            continue;
+
+        ring_buffer__consume(reader.rb);
+        seal_ringbuf_window(reader);
+        if (verbose) {
+            std::cout << "[INFO]\t[ " << reader.window_second << "]\t Wakeups = " << stats.polls\
+                << ", events = " << stats.events << std::endl;
+        }
+        report_overflows(reader.window_second, overflow);
+        report_evictions(reader.window_second);
+        hand_to_exporter(export_queue, reader.window_second);
+        expire_idle_keys(incarnations, expired_keys, reader.window_second, true, expired,
+                         [&](uint32_t ip) { return ringbuf_key_mapped(reader, ip); });
+        for (uint32_t ip : expired) {
+            reader.latest_tcp.erase(ip);
+            reader.latest_udp.erase(ip);
+            reader.start_tcp.erase(ip);
+            reader.start_udp.erase(ip);
+        }
+        if (print_stats) {
+            print_collector_stats(reader.window_second, "ringbuf");
+        }
+
+        reader.window_second = curr_second;
+        reader.window_id = curr_second % SLOTS_IN_GLOBAL_RING_BUFFER;
+        reader.realtime_minus_mono = realtime_minus_monotonic_ns();
+    }
+    ring_buffer__free(reader.rb);
 }
 
 
@@ -525,7 +2470,14 @@ void print_in_json(
 CLI helper functions
 */
 void print_usage(const char* prog) {
-    std::cerr << "Usage: " << prog <<" [-p poll-hz] [-m map-path]" << std::endl;
+    std::cerr << "Usage: " << prog <<" [-p poll-hz] [-m map-path] [--map6-path path] [-b hash|mmap|bins|ringbuf] [-w bin-width-us]"\
+        << " [--emit-every-us us] [--emit-every-packets n] [-v] [-s|--stats] [--no-batch]"\
+        << " [--load kernel-obj.o [--max-entries n]]"\
+        << " [--export-queue n] [--export-policy drop-oldest|block] [--export-cpu cpu]"\
+        << " [--export-mode deltas|rates|timestamps] [--bin-encoding dense|sparse|rle] [--binary-out path]"\
+        << " [--shm-ring name [--shm-mb mb] [--shm-windows n]] [--metrics-port port]"\
+        << " [--wait sleep|spin|hybrid] [--spin-us us] [--poll-cpu cpu] [--fifo prio]"\
+        << " [--history-sec seconds] [--rollup-1s slots] [--rollup-1m slots] [--rollup-export]" << std::endl;
 }
 
 void parse_args(int argc, char** argv,
@@ -538,14 +2490,153 @@ void parse_args(int argc, char** argv,
             map_path = argv[++i];
         } else if (arg == "-v" || arg == "--verbose") {
             verbose = true;
+        } else if (arg == "--map6-path" && i + 1 < argc) {
+            map6_path = argv[++i];
+        } else if ((arg == "-b" || arg == "--backend") && i + 1 < argc) {
+            backend = argv[++i];
+            if (backend != "hash" && backend != "mmap" && backend != "bins" && backend != "ringbuf") {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        } else if ((arg == "-w" || arg == "--bin-width-us") && i + 1 < argc) {
+            bin_width_ns = std::stoull(argv[++i]) * 1000;
+        } else if (arg == "--emit-every-us" && i + 1 < argc) {
+            emit_every_ns = std::stoull(argv[++i]) * 1000;
+        } else if (arg == "--emit-every-packets" && i + 1 < argc) {
+            emit_every_packets = std::stoull(argv[++i]);
+        } else if (arg == "-s" || arg == "--stats") {
+            print_stats = true;
+        } else if (arg == "--no-batch") {
+            use_batch = false;
+        } else if (arg == "--load" && i + 1 < argc) {
+            load_obj = argv[++i];
+        } else if (arg == "--max-entries" && i + 1 < argc) {
+            max_entries = static_cast<__u32>(std::stoul(argv[++i]));
+        } else if (arg == "--export-queue" && i + 1 < argc) {
+            export_queue_len = std::stoul(argv[++i]);
+            // Queued windows plus the one being exported must fit in the ring.
+            if (export_queue_len < 1 || export_queue_len > SLOTS_IN_GLOBAL_RING_BUFFER - 2) {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        } else if (arg == "--export-policy" && i + 1 < argc) {
+            export_policy = argv[++i];
+            if (export_policy != "drop-oldest" && export_policy != "block") {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        } else if (arg == "--export-mode" && i + 1 < argc) {
+            export_mode = argv[++i];
+            if (export_mode != "deltas" && export_mode != "rates" && export_mode != "timestamps") {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        } else if (arg == "--bin-encoding" && i + 1 < argc) {
+            bin_encoding = argv[++i];
+            if (bin_encoding != "dense" && bin_encoding != "sparse" && bin_encoding != "rle") {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        } else if (arg == "--binary-out" && i + 1 < argc) {
+            binary_out = argv[++i];
+        } else if (arg == "--shm-ring" && i + 1 < argc) {
+            shm_ring_name = argv[++i];
+        } else if (arg == "--shm-mb" && i + 1 < argc) {
+            shm_ring_mb = std::stoul(argv[++i]);
+        } else if (arg == "--shm-windows" && i + 1 < argc) {
+            shm_ring_windows = std::stoul(argv[++i]);
+            if (shm_ring_windows < 1) {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            unsigned long port = std::stoul(argv[++i]);
+            if (port < 1 || port > 65535) {
+                print_usage(argv[0]);
+                exit(1);
+            }
+            metrics_port = static_cast<uint16_t>(port);
+        } else if (arg == "--wait" && i + 1 < argc) {
+            wait_mode = argv[++i];
+            if (wait_mode != "sleep" && wait_mode != "spin" && wait_mode != "hybrid") {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        } else if (arg == "--spin-us" && i + 1 < argc) {
+            spin_ns = std::stoull(argv[++i]) * 1000;
+        } else if (arg == "--poll-cpu" && i + 1 < argc) {
+            poll_cpu = std::stoi(argv[++i]);
+        } else if (arg == "--fifo" && i + 1 < argc) {
+            fifo_prio = std::stoi(argv[++i]);
+        } else if (arg == "--history-sec" && i + 1 < argc) {
+            history_sec = static_cast<time_t>(std::stoll(argv[++i]));
+        } else if (arg == "--rollup-1s" && i + 1 < argc) {
+            rollup_1s_slots = std::stoul(argv[++i]);
+        } else if (arg == "--rollup-1m" && i + 1 < argc) {
+            rollup_1m_slots = std::stoul(argv[++i]);
+        } else if (arg == "--rollup-export") {
+            rollup_export = true;
+        } else if (arg == "--export-cpu" && i + 1 < argc) {
+            export_cpu = std::stoi(argv[++i]);
         } else {
             print_usage(argv[0]);
             exit(1);
         }
     }
+    // --max-entries only resizes the LRU hash maps of an object loaded with --load.
+    if (max_entries > 0 && (load_obj.empty() || backend == "bins" || backend == "mmap")) {
+        std::cerr << "--max-entries needs --load and the hash or ringbuf layout" << std::endl;
+        print_usage(argv[0]);
+        exit(1);
+    }
 
     std::cout << "Poll the eBPF map at " << poll_hz << " Hz\n";
     std::cout << "Processing the eBPF map pinned at: " << map_path << "\n";
+    if (!load_obj.empty()) {
+        std::cout << "Loading " << load_obj << " with max_entries "
+                  << (max_entries ? std::to_string(max_entries) : std::string("from the ELF")) << "\n";
+    }
+    if (!map6_path.empty()) {
+        std::cout << "Processing the IPv6 eBPF map pinned at: " << map6_path << "\n";
+    }
+    std::cout << "Map backend: " << backend << "\n";
+    if (backend == "bins") {
+        std::cout << "In-kernel bin width: " << bin_width_ns / 1000 << " us\n";
+    } else if (backend == "ringbuf") {
+        std::cout << "Kernel records every " << emit_every_ns / 1000 << " us or "
+                  << emit_every_packets << " packets per key\n";
+    }
+    std::cout << "Batched map reads: " << (use_batch ? "ON" : "OFF") << "\n";
+    std::cout << "Export queue: " << export_queue_len << " windows, " << export_policy
+              << (export_cpu >= 0 ? ", exporter on CPU " + std::to_string(export_cpu) : std::string()) << "\n";
+    if (binary_out.empty()) {
+        std::cout << "Export mode: " << export_mode << ", " << bin_encoding << " bins\n";
+    } else {
+        std::cout << "Binary export to " << binary_out << "\n";
+    }
+    if (!shm_ring_name.empty()) {
+        std::cout << "Shared-memory ring: /dev/shm/" << shm_ring_name << ", " << shm_ring_mb << " MB, "
+                  << shm_ring_windows << " windows\n";
+    }
+    if (metrics_port != 0) {
+        std::cout << "OpenMetrics: http://127.0.0.1:" << metrics_port << "/metrics\n";
+    }
+    if (history_sec > 0) {
+        std::cout << "Compressed history: " << history_sec << " s\n";
+    }
+    if (rollup_1s_slots > 0 || rollup_1m_slots > 0) {
+        std::cout << "Rollups: " << rollup_1s_slots << " x 1 s, " << rollup_1m_slots << " x 1 min"
+                  << (rollup_export ? ", printed" : "") << "\n";
+    }
+    if (backend == "hash" || backend == "mmap") {
+        std::cout << "Poll wait: " << wait_mode
+                  << (wait_mode == "hybrid" ? ", spinning the last " + std::to_string(spin_ns / 1000) + " us" : std::string())
+                  << "\n";
+    }
+    if (poll_cpu >= 0 || fifo_prio > 0) {
+        std::cout << "Poll thread: CPU " << (poll_cpu >= 0 ? std::to_string(poll_cpu) : std::string("any"))
+                  << ", " << (fifo_prio > 0 ? "SCHED_FIFO " + std::to_string(fifo_prio) : std::string("SCHED_OTHER")) << "\n";
+    }
     std::cout << "Verbose mode: " << (verbose ? "ON" : "OFF") << "\n\n";
 }
 /* CLI helper functions
@@ -559,31 +2650,137 @@ int main(int argc, char** argv) {
     std::signal(SIGINT, handle_signal);
     std::signal(SIGTERM, handle_signal);
 
-    std::map<uint32_t, LastSeen> last_seen;
+    if (!load_obj.empty() && load_and_pin_object(load_obj, map_path, max_entries) != 0) {
+        perror("Failed to load and pin the kernel object");
+        exit(1);
+    }
+    if (open_overflow_reader(map_path, overflow) != 0) {
+        std::cerr << "Warning: no overflow counter pinned at " << map_path << "_ovf" << std::endl;
+    }
 
-    // Sanity check for openning the eBPF map
-    int map_fd = bpf_obj_get(map_path.c_str());
-    if (map_fd < 0) {
+    report_writer.set_encoding(bin_encoding == "sparse" ? BIN_SPARSE :
+                               bin_encoding == "rle" ? BIN_RLE : BIN_DENSE);
+    if (metrics_port != 0 && metrics_server.start(metrics_port) != 0) {
+        perror(("Failed to listen on 127.0.0.1:" + std::to_string(metrics_port)).c_str());
+        exit(1);
+    }
+    history.set_retention(history_sec);
+    history6.set_retention(history_sec);
+    rollups.sec.init(1, rollup_1s_slots);
+    rollups.min.init(60, rollup_1m_slots);
+    rollups6.sec.init(1, rollup_1s_slots);
+    rollups6.min.init(60, rollup_1m_slots);
+
+    // Sanity check for openning the eBPF map. Everything that can fail is set up before
+    // the exporter thread starts, so that the error paths can simply exit.
+    MapReader reader;
+    MmapReader mmap_reader;
+    TimeBinsReader bins_reader;
+    RingbufReader rb_reader;
+    if (backend == "bins") {
+        if (open_time_bins_reader(map_path, bin_width_ns, bins_reader) != 0) {
+            perror("Failed to open the time-binned BPF map");
+            exit(1);
+        }
+    } else if (backend == "ringbuf") {
+        if (open_ringbuf_reader(map_path, rb_reader) != 0) {
+            perror("Failed to open the BPF ring buffer");
+            exit(1);
+        }
+    } else if (backend == "mmap") {
+        if (open_mmap_reader(map_path, mmap_reader) != 0) {
+            perror("Failed to open and mmap the BPF counter array");
+            exit(1);
+        }
+    } else if (open_map_reader(map_path, reader) != 0) {
         perror("Failed to open BPF map");
         exit(1);
     }
-
-    /**
-     * Continuously polls the eBPF map and aggregates the snapshots into time-series metric bins.
-    */
-    if (1000000 % poll_hz != 0) {
+    MapReader reader6;
+    if (!map6_path.empty()) {
+        if (backend != "hash") {
+            std::cerr << "Error: --map6-path is only supported by the \"hash\" backend" << std::endl;
+            exit(1);
+        }
+        if (open_map_reader(map6_path, reader6) != 0 || reader6.key_size != sizeof(traffic_key6_t)) {
+            perror("Failed to open the IPv6 BPF map");
+            exit(1);
+        }
+    }
+    if (reader.percpu) {
+        std::cout << "Per-CPU map detected, summing values over " << reader.num_cpus << " CPUs\n";
+    }
+    if (poll_hz <= 0) {
         std::cout << "Error, polling frequency not supported!";
         exit(-1);
     }
-    auto interval_in_microseconds = std::chrono::microseconds(1000000 / poll_hz);
+    window_ticks = backend == "bins" ? bins_reader.bins_per_sec : static_cast<uint32_t>(poll_hz);
+    if (!binary_out.empty() && binary_writer.open(binary_out, window_ticks) != 0) {
+        perror(("Failed to create " + binary_out).c_str());
+        exit(1);
+    }
+    if (!shm_ring_name.empty() && shm_ring.create(shm_ring_name, shm_ring_mb << 20, shm_ring_windows,
+                                                  window_ticks) != 0) {
+        perror(("Failed to create the shared-memory ring " + shm_ring_name).c_str());
+        exit(1);
+    }
+
+    // The exporter thread serializes the finished windows; stopped and joined on return.
+    ExportQueue export_queue(export_queue_len);
+    std::thread exporter(export_windows, std::ref(export_queue), verbose);
+    auto stop_exporter = [&]() {
+        export_queue.stop();
+        exporter.join();
+        binary_writer.close();
+        shm_ring.close();
+        metrics_server.stop();
+        if (print_stats && history.enabled()) {
+            print_history_summary();
+        }
+    };
+
+    // Set up the poll thread after starting the exporter, so that it keeps SCHED_OTHER.
+    if (poll_cpu >= 0) {
+        pin_current_thread(poll_cpu, "poll thread");
+    }
+    if (fifo_prio > 0) {
+        set_fifo_priority(fifo_prio);
+    }
 
-    time_t last_ts = now_sec();
-    uint32_t polling_counter = 0;
+    if (backend == "bins") {
+        poll_time_bins(bins_reader, export_queue, verbose);
+        stop_exporter();
+        return 0;
+    } else if (backend == "ringbuf") {
+        poll_ringbuf(rb_reader, export_queue, verbose);
+        stop_exporter();
+        return 0;
+    }
+
+    /**
+     * Continuously polls the eBPF map and aggregates the snapshots into time-series metric bins.
+    */
+    PollScheduler scheduler(poll_hz);
+    time_t last_ts = scheduler.second;
     int window_id = -1;
+    SnapshotBuffer<uint32_t> snapshot;
+    SnapshotBuffer<Ip6Addr> snapshot6;
+    bool window_polled = false, window_polled6 = false;     // a snapshot reached the current window
+    std::vector<uint32_t> expired;
+    std::vector<Ip6Addr> expired6;
+    snapshot.reserve(backend == "mmap" ? mmap_reader.max_slots : reader.max_entries);
+    snapshot6.reserve(reader6.max_entries);
     while (running) {
-        std::map<uint32_t, traffic_val_t> snapshot_tcp;
-        std::map<uint32_t, traffic_val_t> snapshot_udp;
-        time_t curr_second = now_sec();
+        time_t curr_second;
+        uint32_t first_tick, polling_counter;
+        stats.missed_ticks += scheduler.wait(curr_second, first_tick, polling_counter);
+        if (!running)
+            break;
+        stats.jitter.add(scheduler.late_ns);
+        jitter_total.add(scheduler.late_ns);
+
+        const __u64 allocs_before = thread_allocs;
+        snapshot.clear();
 
         // Using steady_clock() to measure time elapsed.
         /// TODO: ~1K cycles for timing @param elapsed
@@ -593,33 +2790,66 @@ int main(int argc, char** argv) {
             if (verbose) {
                 std::cout << "### New tick: " << curr_second << ", window_id=" << window_id << std::endl;
                 }
-            // std::thread(print_latest_metric_bin, last_ts).detach();
-            std::thread(print_in_json, last_ts, std::ref(last_seen), verbose).detach();
-            polling_counter = 0;
+            report_overflows(last_ts, overflow);
+            report_evictions(last_ts);
+            hand_to_exporter(export_queue, last_ts);
+            expire_idle_keys(incarnations, expired_keys, last_ts, window_polled, expired);
+            if (flow_keys) {
+                for (uint32_t id : expired)
+                    flows.retire(id);
+            }
+            expire_idle_keys(incarnations6, expired_keys6, last_ts, window_polled6, expired6);
+            window_polled = false;
+            window_polled6 = false;
+            if (print_stats) {
+                print_collector_stats(last_ts,
+                    backend == "mmap" ? "mmap" : (reader.batch ? "batch" : "walk"));
+            }
             last_ts = curr_second;
         }
 
         window_id = curr_second % SLOTS_IN_GLOBAL_RING_BUFFER;
-        if (get_snapshot_bpf_map(map_fd, snapshot_tcp, snapshot_udp) == 0) {
-            append_snapshot_to_metric_bins(window_id, polling_counter, poll_hz,
-                snapshot_tcp, snapshot_udp);
+        const bool owned = poller_owns(window_id);
+        if (!owned)
+            stats.busy_polls += 1;
+        const __u64 tick_ns = monotonic_ns();   // sampling time of this tick
+        int snapshot_err = (backend == "mmap")
+            ? get_snapshot_mmap(mmap_reader, snapshot)
+            : get_snapshot_bpf_map(reader, snapshot);
+        if (snapshot_err == 0 && owned) {
+            append_snapshot_to_metric_bins(gBuffer, incarnations, window_id, first_tick, polling_counter, tick_ns,
+                poll_hz,
+                snapshot);
+            window_polled = true;
         }
+        __u64 snapshot_syscalls = (backend == "mmap") ? mmap_reader.last_syscalls : reader.last_syscalls;
+        if (reader6.fd >= 0) {
+            snapshot6.clear();
+            if (get_snapshot_bpf_map(reader6, snapshot6) == 0 && owned) {
+                append_snapshot_to_metric_bins(gBuffer6, incarnations6, window_id, first_tick, polling_counter,
+                    tick_ns, poll_hz,
+                    snapshot6);
+                window_polled6 = true;
+            }
+            snapshot_syscalls += reader6.last_syscalls;
+        }
+        stats.polls += 1;
+        stats.syscalls += snapshot_syscalls;
+        stats.allocs += thread_allocs - allocs_before;
 
-        polling_counter += 1;
-
-         // Sleep adjustment
         auto loop_end = std::chrono::steady_clock::now();
         auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(loop_end - loop_start);
 
         if (verbose) {
             std::cout << "[INFO]\t[ " << curr_second << "]\t Polled_times = "\
-                << polling_counter << ", elapsed_microseconds = " << elapsed.count() << std::endl;
-        }
-
-        if (elapsed < interval_in_microseconds) {
-            std::this_thread::sleep_for(interval_in_microseconds - elapsed);
+                << polling_counter + 1 << ", elapsed_microseconds = " << elapsed.count()\
+                << ", syscalls = " << snapshot_syscalls << std::endl;
         }
     }
 
+    stop_exporter();
+    if (print_stats) {
+        print_jitter_summary();
+    }
     return 0;
 }
@@ -0,0 +1,170 @@
+/**
+ * Test of the compressed window history (history_store.h).
+ *
+ * Windows of known cumulative values are appended for more seconds than the retention
+ * holds: steady and bursty rows, rows that stop part-way (trailing zeros), values near
+ * 2^64 and jittered tick times. Every window still held must decode exactly through
+ * `decode()`, `decode_ticks()` and `for_each_key()`; the older ones must be gone, also
+ * across a gap in the seconds. Prints the encoded size of one steady IP and of the tick
+ * times, scaled to an hour.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 test_history_store.cpp -o test_history_store
+ * Run:
+ *   ./test_history_store [ticks=1000]
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "window_store.h"
+#include "history_store.h"
+
+constexpr time_t RETENTION = 10;
+constexpr size_t ROWS = 6;
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Key of row `r`; keys are inserted in descending order so that the chunk must sort them.
+static uint32_t key_of(const size_t r) { return static_cast<uint32_t>(0x0a000100 + ROWS - r); }
+
+// Cumulative value of row `r` and metric `m` at tick `t` of the window of `second`.
+static __u64 value(const time_t second, const size_t r, const size_t m, const size_t t) {
+    const uint64_t s = static_cast<uint64_t>(second);
+    switch (r) {
+    case 0:     // steady: the same delta every tick
+        return s * 1000000 + (m + 1) * 1500 * (t + 1);
+    case 1:     // idle
+        return s * 1000;
+    case 2:     // bursty
+        return s * 7919 + (t + 1) * (m + 1) * 64 + mix(s * 131 + t * 7 + m) % 65536;
+    case 3:     // near the top of the range, wrapping
+        return ~0ULL - 1000 + s + t * 17 * (m + 1);
+    case 4: {   // stops part-way: trailing zeros
+        const size_t stop = static_cast<size_t>(s * 37 + m) % 1000;
+        return t < stop ? s + (t + 1) * 100 : 0;
+    }
+    default:    // arbitrary
+        return mix(s * 1000003 + t * 101 + m);
+    }
+}
+
+// Sampling time of tick `t`: a 1 ms period with a few microseconds of jitter.
+static __u64 tick_time(const time_t second, const size_t t, const size_t ticks) {
+    return static_cast<__u64>(second) * 1000000000ULL + (t + 1) * (1000000000ULL / ticks)
+        + mix(static_cast<uint64_t>(second) * 1009 + t) % 10000;
+}
+
+static void make_window(const time_t second, WindowStore<uint32_t>& w, const size_t rows) {
+    w.clear();
+    for (size_t t = 0; t < w.ticks(); ++t)
+        w.tick_ns()[t] = tick_time(second, t, w.ticks());
+    for (size_t r = 0; r < rows; ++r) {
+        const size_t row = w.find_or_insert(key_of(r));
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            for (size_t t = 0; t < w.ticks(); ++t)
+                w.row(row, static_cast<WindowMetric>(m))[t] = value(second, r, m, t);
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t ticks = argc > 1 ? std::stoul(argv[1]) : 1000;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        if (!ok) {
+            std::printf("%s\n", what.c_str());
+            failures += 1;
+        }
+    };
+
+    WindowStore<uint32_t> window;
+    window.init(ticks);
+    HistoryStore<uint32_t> history;
+    check(!history.enabled(), "enabled without a retention");
+    history.append(1, window);
+    check(history.num_windows() == 0, "disabled store appended a window");
+
+    // Seconds 100..139, except a gap at 120..124; the retention keeps the last 10 s.
+    history.set_retention(RETENTION);
+    std::vector<time_t> appended;
+    for (time_t s = 100; s < 140; ++s) {
+        if (s >= 120 && s < 125)
+            continue;
+        make_window(s, window, ROWS);
+        history.append(s, window);
+        appended.push_back(s);
+        // The store must not depend on the window after append().
+        window.clear();
+        if (s == 122 + RETENTION - 1)
+            check(history.seconds().front() == 125, "gap: windows out of the retention kept");
+    }
+
+    const std::vector<time_t> held = history.seconds();
+    check(held.size() == static_cast<size_t>(RETENTION), "retention: " + std::to_string(held.size()) + " windows held");
+    for (size_t i = 0; i < held.size(); ++i)
+        check(held[i] == 130 + static_cast<time_t>(i), "retention: unexpected second " + std::to_string(held[i]));
+    std::vector<__u64> vals;
+    check(!history.decode(129, key_of(0), TCP_BYTES, vals), "decoded a dropped window");
+    check(!history.decode_ticks(129, vals), "decoded the ticks of a dropped window");
+    check(!history.decode(135, 0x01020304, TCP_BYTES, vals), "decoded a key not in the window");
+    check(!history.for_each_key(150, [](uint32_t, WindowMetric, const std::vector<__u64>&) {}),
+          "walked a window not held");
+
+    for (const time_t s : held) {
+        const std::string at = " at " + std::to_string(s);
+        check(history.decode_ticks(s, vals) && vals.size() == ticks, "decode_ticks failed" + at);
+        for (size_t t = 0; t < vals.size(); ++t)
+            if (vals[t] != tick_time(s, t, ticks)) {
+                check(false, "tick time differs" + at);
+                break;
+            }
+        for (size_t r = 0; r < ROWS; ++r) {
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                const bool ok = history.decode(s, key_of(r), static_cast<WindowMetric>(m), vals);
+                bool same = ok && vals.size() == ticks;
+                for (size_t t = 0; same && t < ticks; ++t)
+                    same = vals[t] == value(s, r, m, t);
+                check(same, "row " + std::to_string(r) + " metric " + std::to_string(m) + " differs" + at);
+            }
+        }
+        size_t calls = 0;
+        uint32_t prev_key = 0;
+        bool ordered = true, same = true;
+        const bool walked = history.for_each_key(s, [&](uint32_t key, WindowMetric m, const std::vector<__u64>& v) {
+            ordered &= key >= prev_key;
+            prev_key = key;
+            const size_t r = ROWS - (key - 0x0a000100);
+            for (size_t t = 0; same && t < ticks; ++t)
+                same = v[t] == value(s, r, m, t);
+            calls += 1;
+        });
+        check(walked && calls == ROWS * NUM_WINDOW_METRICS && ordered && same, "for_each_key differs" + at);
+    }
+
+    // Encoded size of the same window: the tick times alone, then with one steady IP.
+    HistoryStore<uint32_t> ticks_only, one_ip;
+    ticks_only.set_retention(RETENTION);
+    one_ip.set_retention(RETENTION);
+    make_window(200, window, 0);
+    ticks_only.append(200, window);
+    make_window(200, window, 1);
+    one_ip.append(200, window);
+    const size_t tick_bytes = ticks_only.memory_bytes();
+    const size_t ip_bytes = one_ip.memory_bytes() - tick_bytes;
+    const size_t raw_bytes = ticks * NUM_WINDOW_METRICS * sizeof(__u64);
+    std::printf("%zu ticks per window: tick times %zu B, one steady IP %zu B (raw %zu B); per hour %.1f MB + %.1f MB\n",
+                ticks, tick_bytes, ip_bytes, raw_bytes, tick_bytes * 3600 / 1e6, ip_bytes * 3600 / 1e6);
+    check(ip_bytes < raw_bytes / 6, "steady IP not compressed to about one byte per tick and metric");
+
+    std::printf("%zu windows appended, %zu held: %s\n", appended.size(), held.size(), failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
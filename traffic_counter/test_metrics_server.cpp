@@ -0,0 +1,157 @@
+/**
+ * Test of the OpenMetrics listener (metrics_server.h), entirely over 127.0.0.1: the
+ * server is started on a free port and scraped with plain sockets.
+ *
+ * Checks the responses to GET /metrics, HEAD, other paths and other methods, then
+ * publishes new expositions from one thread while others scrape: every scrape must
+ * return one complete exposition, never a mix of two.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 test_metrics_server.cpp -o test_metrics_server -lpthread
+ * Run:
+ *   ./test_metrics_server [publishes=2000] [scrapers=3]
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics_server.h"
+
+// Send `request` to 127.0.0.1:`port` and return the whole response, empty on failure.
+static std::string fetch(const uint16_t port, const std::string& request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return {};
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    std::string response;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0
+        && send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size())) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+            response.append(buf, static_cast<size_t>(n));
+    }
+    close(fd);
+    return response;
+}
+
+static std::string get(const uint16_t port, const std::string& path, const char* method = "GET") {
+    return fetch(port, std::string(method) + " " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+}
+
+static std::string body_of(const std::string& response) {
+    const size_t end = response.find("\r\n\r\n");
+    return end == std::string::npos ? std::string() : response.substr(end + 4);
+}
+
+// Exposition number `n`: every sample carries `n`, so a scrape can tell it is whole.
+static std::string exposition(const uint64_t n) {
+    std::string text;
+    OpenMetricsWriter om(text);
+    om.family("tc_bytes", "counter", "Bytes counted by the kernel program.");
+    for (uint32_t ip = 1; ip <= 50; ++ip) {
+        std::string labels = "ip=\"" + std::to_string(ip) + "\",proto=\"tcp\"";
+        om.sample("tc_bytes", "_total", labels, n);
+    }
+    om.family("tc_last_window_timestamp_seconds", "gauge", "Second of the last exported window.");
+    om.sample("tc_last_window_timestamp_seconds", "", "", n);
+    om.eof();
+    return text;
+}
+
+// The `n` of a whole exposition, or -1.
+static int64_t exposition_number(const std::string& body) {
+    const std::string key = "tc_last_window_timestamp_seconds ";
+    const size_t at = body.rfind(key);
+    if (at == std::string::npos)
+        return -1;
+    const uint64_t n = std::stoull(body.substr(at + key.size()));
+    return body == exposition(n) ? static_cast<int64_t>(n) : -1;
+}
+
+int main(int argc, char** argv) {
+    size_t publishes = argc > 1 ? std::stoul(argv[1]) : 2000;
+    size_t num_scrapers = argc > 2 ? std::stoul(argv[2]) : 3;
+    size_t failures = 0;
+    auto check = [&](bool ok, const char* what) {
+        if (!ok) {
+            std::printf("%s\n", what);
+            failures += 1;
+        }
+    };
+
+    MetricsServer server;
+    if (server.start(0) != 0) {
+        perror("Failed to listen on 127.0.0.1");
+        return 1;
+    }
+    const uint16_t port = server.port();
+
+    std::string r = get(port, "/metrics");
+    check(r.rfind("HTTP/1.1 200 OK\r\n", 0) == 0, "GET /metrics: not 200");
+    check(body_of(r) == "# EOF\n", "GET /metrics before publish: not an empty exposition");
+
+    server.publish(exposition(7));
+    r = get(port, "/metrics?name[]=tc_bytes");
+    check(r.find(std::string("Content-Type: ") + OPENMETRICS_CONTENT_TYPE + "\r\n") != std::string::npos,
+          "GET /metrics: no OpenMetrics content type");
+    check(r.find("Content-Length: " + std::to_string(exposition(7).size()) + "\r\n") != std::string::npos,
+          "GET /metrics: wrong content length");
+    check(body_of(r) == exposition(7), "GET /metrics: not the published exposition");
+    r = get(port, "/metrics", "HEAD");
+    check(r.rfind("HTTP/1.1 200 OK\r\n", 0) == 0 && body_of(r).empty(), "HEAD /metrics: not 200 without body");
+    check(get(port, "/").rfind("HTTP/1.1 404 ", 0) == 0, "GET /: not 404");
+    check(get(port, "/metrics", "POST").rfind("HTTP/1.1 405 ", 0) == 0, "POST /metrics: not 405");
+    check(fetch(port, "garbage\r\n\r\n").rfind("HTTP/1.1 400 ", 0) == 0, "garbage request: not 400");
+    const uint64_t served = server.scrapes();
+    check(served == 3, "scrape count");
+
+    // Scrapes racing with publishes.
+    std::atomic<bool> done{false};
+    std::vector<size_t> scraped(num_scrapers), torn(num_scrapers);
+    std::vector<std::thread> scrapers;
+    for (size_t i = 0; i < num_scrapers; ++i) {
+        scrapers.emplace_back([&, i]() {
+            int64_t last = 0;
+            while (!done.load(std::memory_order_acquire)) {
+                const int64_t n = exposition_number(body_of(get(port, "/metrics")));
+                // Whole, and never older than the previous scrape of this thread.
+                if (n < last)
+                    torn[i] += 1;
+                last = n < 0 ? last : n;
+                scraped[i] += 1;
+            }
+        });
+    }
+    for (uint64_t n = 8; n < 8 + publishes; ++n)
+        server.publish(exposition(n));
+    done.store(true, std::memory_order_release);
+    for (auto& t : scrapers)
+        t.join();
+    for (size_t i = 0; i < num_scrapers; ++i) {
+        std::printf("scraper %zu: %zu scrapes, %zu torn\n", i, scraped[i], torn[i]);
+        failures += torn[i];
+    }
+    check(exposition_number(body_of(get(port, "/metrics"))) == static_cast<int64_t>(7 + publishes),
+          "GET /metrics: not the latest exposition");
+
+    server.stop();
+    check(!server.running() && get(port, "/metrics").empty(), "listening after stop()");
+
+    std::printf("%zu publishes, %zu scrapers: %s\n", publishes, num_scrapers, failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
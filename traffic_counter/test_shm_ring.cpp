@@ -0,0 +1,167 @@
+/**
+ * Test of the shared-memory window ring (shm_ring.h): one writer thread publishes
+ * windows as fast as it can into a ring that holds only a few of them, while several
+ * reader threads read the latest windows in place.
+ *
+ * Every delta is a known function of (second, row, metric, tick). A reader compares
+ * what it read with it, then asks `ShmRingReader::valid()`: a window reported intact
+ * must match exactly; overwritten ones are only counted. The writer never waits.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 test_shm_ring.cpp -o test_shm_ring -lpthread -lrt
+ * Run:
+ *   ./test_shm_ring [windows=20000] [readers=3]
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "window_store.h"
+#include "delta_kernel.h"
+#include "tc_binary.h"
+#include "shm_ring.h"
+
+constexpr size_t TICKS = 100;
+constexpr size_t MAX_ROWS = 8;
+
+static __u64 expected_delta(int64_t second, size_t r, size_t m, size_t t) {
+    return static_cast<__u64>(second) * 1000003 + r * 1009 + m * 101 + t + 1;
+}
+
+// Rows of a window; the last row of odd windows stops early.
+static size_t rows_of(int64_t second) { return 1 + static_cast<size_t>(second) % MAX_ROWS; }
+static size_t valid_of(int64_t second, size_t r) {
+    return (second % 2 == 1 && r + 1 == rows_of(second)) ? TICKS / 2 : TICKS;
+}
+
+struct ReaderResult {
+    size_t intact = 0;      // windows read and reported intact
+    size_t torn = 0;        // windows overwritten while read
+    size_t errors = 0;      // intact windows with wrong contents
+};
+
+static void read_ring(const std::string& name, const std::atomic<bool>& done, ReaderResult& res) {
+    ShmRingReader reader;
+    if (reader.attach(name) != 0) {
+        perror("attach");
+        res.errors += 1;
+        return;
+    }
+    std::vector<ShmWindowView> views;
+    while (!done.load(std::memory_order_acquire)) {
+        reader.latest(4, views);
+        int64_t prev = -1;
+        for (const ShmWindowView& v : views) {
+            size_t bad = 0;
+            if (v.second() <= prev || v.size() != rows_of(v.second()) || v.ticks() != TICKS)
+                bad += 1;
+            prev = v.second();
+            for (size_t r = 0; r < v.size() && !bad; ++r) {
+                bad += v.key_type(r) != TC_KEY_IPV4 || le_get(v.key(r), 4) != r + 1;
+                bad += v.tick_ns()[r] != static_cast<__u64>(v.second()) * TICKS + r;
+                for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                    const WindowMetric metric = static_cast<WindowMetric>(m);
+                    const size_t valid = valid_of(v.second(), r);
+                    bad += v.valid_len(r, metric) != valid;
+                    const __u64* d = v.deltas(r, metric);
+                    for (size_t t = 0; t < TICKS; ++t)
+                        bad += d[t] != (t < valid ? expected_delta(v.second(), r, m, t) : 0);
+                }
+            }
+            if (!reader.valid(v)) {
+                res.torn += 1;
+            } else {
+                res.intact += 1;
+                res.errors += bad ? 1 : 0;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t windows = argc > 1 ? std::stoul(argv[1]) : 20000;
+    const size_t num_readers = argc > 2 ? std::stoul(argv[2]) : 3;
+    const std::string name = "tc_test_shm_ring_" + std::to_string(getpid());
+
+    ShmRingReader missing;
+    if (missing.attach(name) == 0) {
+        std::printf("attached to a ring that does not exist\n");
+        return 1;
+    }
+
+    // Room for about 3 of the largest windows, so that readers race the writer.
+    ShmRingWriter writer;
+    if (writer.create(name, 3 * shm_record_len(TICKS, MAX_ROWS), 16, 100) != 0) {
+        perror("create");
+        return 1;
+    }
+
+    std::atomic<bool> done(false);
+    std::vector<ReaderResult> results(num_readers);
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < num_readers; ++i)
+        readers.emplace_back(read_ring, name, std::cref(done), std::ref(results[i]));
+
+    DeltaWindow deltas;
+    std::vector<__u64> tick_ns(TICKS);
+    for (size_t w = 0; w < windows; ++w) {
+        const int64_t second = static_cast<int64_t>(w);
+        const size_t rows = rows_of(second);
+        deltas.resize(rows, TICKS);
+        for (size_t r = 0; r < rows; ++r) {
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                const WindowMetric metric = static_cast<WindowMetric>(m);
+                deltas.valid_len(r, metric) = static_cast<uint32_t>(valid_of(second, r));
+                for (size_t t = 0; t < TICKS; ++t)
+                    deltas.row(r, metric)[t] = expected_delta(second, r, m, t);
+            }
+        }
+        for (size_t t = 0; t < TICKS; ++t)
+            tick_ns[t] = static_cast<__u64>(second) * TICKS + t;
+
+        writer.begin_window(second, tick_ns.data(), TICKS);
+        for (size_t r = 0; r < rows; ++r)
+            writer.add_row(binary_key_ipv4(static_cast<uint32_t>(r + 1)), deltas, r);
+        if (!writer.end_window()) {
+            std::printf("window %zu did not fit\n", w);
+            return 1;
+        }
+        if (w % 64 == 0)
+            std::this_thread::yield();  // let the readers in on a single core too
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& t : readers)
+        t.join();
+
+    // The latest windows stay readable after the writer stopped.
+    ShmRingReader reader;
+    std::vector<ShmWindowView> views;
+    size_t failures = 0;
+    if (reader.attach(name) != 0 || reader.published() != windows) {
+        std::printf("published count not visible\n");
+        failures += 1;
+    } else {
+        reader.latest(2, views);
+        if (views.empty() || views.back().second() != static_cast<time_t>(windows - 1) || !reader.valid(views.back())) {
+            std::printf("latest window not readable\n");
+            failures += 1;
+        }
+    }
+    writer.close();
+
+    for (size_t i = 0; i < num_readers; ++i) {
+        std::printf("reader %zu: %zu intact, %zu torn, %zu errors\n", i, results[i].intact,
+                    results[i].torn, results[i].errors);
+        failures += results[i].errors;
+    }
+    std::printf("%zu windows, %zu readers: %s\n", windows, num_readers, failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,291 @@
+/**
+ * Round-trip test of the binary export (tc_binary.h): windows written by `BinaryWriter`
+ * are read back by `BinaryReader` and compared with what was written, and converted to
+ * JSON by tc_convert (path given as the first argument) and compared with the JSON the
+ * collector prints for the same windows.
+ *
+ * Then the file size is limited with RLIMIT_FSIZE so that writes fail part-way through
+ * a record, as on a full disk: the file must stay readable after the limit is lifted,
+ * with every window intact, and past `max_buffer_bytes` whole windows are dropped.
+ * A record length above `TC_BINARY_MAX_RECORD` must be rejected by the reader.
+ *
+ * Compile without CMakeLists.txt:
+ *   g++ -std=c++17 -O2 test_tc_binary.cpp -o test_tc_binary
+ * Run:
+ *   ./test_tc_binary [path/to/tc_convert]
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "window_store.h"
+#include "delta_kernel.h"
+#include "json_writer.h"
+#include "tc_binary.h"
+
+constexpr size_t TICKS = 50;
+
+// ++ A window as written: its rows by key and the tick times
+struct TestWindow {
+    time_t second;
+    std::vector<__u64> tick_ns;
+    std::vector<BinaryKey> keys;
+    DeltaWindow deltas;
+};
+
+static BinaryKey key_of(const size_t r, const time_t second) {
+    switch (r % 3) {
+    case 0:
+        return binary_key_ipv4(static_cast<uint32_t>(0x0a000001 + r));
+    case 1: {
+        Ip6Addr a{};
+        a[0] = 0x20;
+        a[1] = 0x01;
+        a[15] = static_cast<uint8_t>(r);
+        return binary_key_ipv6(a);
+    }
+    default:
+        return binary_key_flow4(0x0a000001, static_cast<uint32_t>(0x0a000100 + r),
+                                static_cast<uint16_t>(40000 + second % 1000), 443);
+    }
+}
+
+// Window `second`: every third window is empty, the others have up to 7 rows of which
+// some metrics stop early or have no valid delta at all.
+static void make_window(const time_t second, TestWindow& w) {
+    w.second = second;
+    w.tick_ns.resize(TICKS);
+    for (size_t t = 0; t < TICKS; ++t)
+        w.tick_ns[t] = static_cast<__u64>(second) * 1000000000ULL + (t + 1) * 20000000ULL;
+    const size_t rows = second % 3 == 0 ? 0 : 1 + static_cast<size_t>(second) % 7;
+    w.keys.clear();
+    w.deltas.resize(rows, TICKS);
+    for (size_t r = 0; r < rows; ++r) {
+        w.keys.push_back(key_of(r, second));
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+            const WindowMetric metric = static_cast<WindowMetric>(m);
+            const size_t valid = (r + m) % 4 == 3 ? 0 : TICKS - (r + m) % 5;
+            w.deltas.valid_len(r, metric) = static_cast<uint32_t>(valid);
+            w.deltas.reset(r, metric) = 0;
+            for (size_t t = 0; t < TICKS; ++t)
+                w.deltas.row(r, metric)[t] = t < valid ? (second * 131 + r * 17 + m * 7 + t) % 23 * 100 : 0;
+        }
+    }
+}
+
+static void write_window(BinaryWriter& writer, TestWindow& w, int& failures) {
+    writer.begin_window(w.second, w.tick_ns.data(), w.tick_ns.size());
+    // Rows of one key type are adjacent in the collector: IPv4 (or flows), then IPv6.
+    for (uint8_t type : {TC_KEY_IPV4, TC_KEY_FLOW4, TC_KEY_IPV6})
+        for (size_t r = 0; r < w.keys.size(); ++r)
+            if (w.keys[r].type == type)
+                writer.add_row(w.keys[r], w.deltas, r);
+    if (writer.end_window() != 0)
+        failures += 1;
+}
+
+// The rows of `w` with any valid delta, by key bytes.
+static std::map<std::string, size_t> rows_with_deltas(const TestWindow& w) {
+    std::map<std::string, size_t> rows;
+    for (size_t r = 0; r < w.keys.size(); ++r) {
+        bool any = false;
+        for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m)
+            any |= w.deltas.valid_len(r, static_cast<WindowMetric>(m)) > 0;
+        if (any) {
+            const BinaryKey& k = w.keys[r];
+            rows[std::string(1, static_cast<char>(k.type)) +
+                 std::string(reinterpret_cast<const char*>(k.bytes), binary_key_size(k.type))] = r;
+        }
+    }
+    return rows;
+}
+
+// Whether the window read back equals the window written.
+static bool same_window(const TestWindow& expected, const BinaryWindow& got) {
+    if (got.second != expected.second || got.tick_ns != expected.tick_ns)
+        return false;
+    std::map<std::string, size_t> rows = rows_with_deltas(expected);
+    size_t seen = 0;
+    for (size_t s = 0; s < got.num_sections; ++s) {
+        const BinarySection& sec = got.sections[s];
+        for (size_t r = 0; r < sec.size(); ++r) {
+            auto it = rows.find(std::string(1, static_cast<char>(sec.key_type)) +
+                                std::string(reinterpret_cast<const char*>(sec.key(r)), sec.key_size));
+            if (it == rows.end())
+                return false;
+            for (size_t m = 0; m < NUM_WINDOW_METRICS; ++m) {
+                const WindowMetric metric = static_cast<WindowMetric>(m);
+                const size_t len = expected.deltas.valid_len(it->second, metric);
+                if (sec.deltas.valid_len(r, metric) != len)
+                    return false;
+                for (size_t t = 0; t < len; ++t)
+                    if (sec.deltas.row(r, metric)[t] != expected.deltas.row(it->second, metric)[t])
+                        return false;
+            }
+            seen += 1;
+        }
+    }
+    return seen == rows.size();
+}
+
+// The JSON line the collector prints for `w`, empty if it has no traffic.
+static std::string collector_json(ReportWriter& report, const TestWindow& w, const bool timestamps) {
+    report.clear();
+    for (size_t r = 0; r < w.keys.size(); ++r) {
+        append_binary_key_label(report.label_buf(), w.keys[r].type, w.keys[r].bytes);
+        report.add_row(w.deltas, r);
+    }
+    if (report.empty())
+        return {};
+    return report.write(w.second, nullptr, timestamps ? w.tick_ns.data() : nullptr,
+                        timestamps ? w.tick_ns.size() : 0);
+}
+
+// Read `path` back; every window must equal the one of its second in `windows`.
+static size_t read_back(const std::string& path, const std::vector<TestWindow>& windows,
+    std::vector<time_t>& seconds, int& failures) {
+    BinaryReader reader;
+    if (!reader.open(path)) {
+        std::printf("%s: %s\n", path.c_str(), reader.error().c_str());
+        failures += 1;
+        return 0;
+    }
+    BinaryWindow w;
+    seconds.clear();
+    while (reader.next(w)) {
+        if (w.second < 0 || static_cast<size_t>(w.second) >= windows.size()
+            || !same_window(windows[static_cast<size_t>(w.second)], w)) {
+            std::printf("window %ld read back differs\n", static_cast<long>(w.second));
+            failures += 1;
+        }
+        seconds.push_back(w.second);
+    }
+    if (!reader.error().empty()) {
+        std::printf("%s: %s\n", path.c_str(), reader.error().c_str());
+        failures += 1;
+    }
+    return seconds.size();
+}
+
+int main(int argc, char** argv) {
+    const std::string tc_convert = argc > 1 ? argv[1] : "";
+    const std::string path = "/tmp/test_tc_binary." + std::to_string(getpid());
+    int failures = 0;
+
+    std::vector<TestWindow> windows(200);
+    for (size_t i = 0; i < windows.size(); ++i)
+        make_window(static_cast<time_t>(i), windows[i]);
+
+    // Round trip, flushed every 3 windows.
+    {
+        BinaryWriter writer;
+        writer.flush_windows = 3;
+        if (writer.open(path, 50) != 0) {
+            perror(("Failed to create " + path).c_str());
+            return 1;
+        }
+        for (TestWindow& w : windows)
+            write_window(writer, w, failures);
+        writer.close();
+    }
+    std::vector<time_t> seconds;
+    if (read_back(path, windows, seconds, failures) != windows.size()) {
+        std::printf("round trip: %zu of %zu windows read back\n", seconds.size(), windows.size());
+        failures += 1;
+    }
+
+    // The same file through tc_convert, against the collector's JSON.
+    if (!tc_convert.empty()) {
+        ReportWriter report;
+        for (const bool timestamps : {false, true}) {
+            std::string expected;
+            for (const TestWindow& w : windows) {
+                const std::string line = collector_json(report, w, timestamps);
+                if (!line.empty())
+                    expected += line + "\n";
+            }
+            const std::string cmd = tc_convert + (timestamps ? " --export-mode timestamps " : " ") + path;
+            FILE* out = popen(cmd.c_str(), "r");
+            std::string got;
+            char buf[65536];
+            size_t n;
+            while (out && (n = std::fread(buf, 1, sizeof(buf), out)) > 0)
+                got.append(buf, n);
+            if (!out || pclose(out) != 0 || got != expected) {
+                std::printf("tc_convert%s: output differs from the collector's JSON\n",
+                            timestamps ? " --export-mode timestamps" : "");
+                failures += 1;
+            }
+        }
+    }
+
+    // Writes failing part-way through records: a file size limit, then lifted again.
+    std::signal(SIGXFSZ, SIG_IGN);
+    struct rlimit old_limit;
+    getrlimit(RLIMIT_FSIZE, &old_limit);
+    for (const bool overflow : {false, true}) {
+        BinaryWriter writer;
+        writer.flush_windows = 1;
+        writer.max_buffer_bytes = overflow ? 16 << 10 : 64 << 20;
+        if (writer.open(path, 50) != 0) {
+            perror(("Failed to create " + path).c_str());
+            return 1;
+        }
+        struct rlimit limit = old_limit;
+        limit.rlim_cur = 20000;     // in the middle of a record
+        setrlimit(RLIMIT_FSIZE, &limit);
+        int write_errors = 0;
+        for (size_t i = 0; i < windows.size(); ++i) {
+            if (i == 150)
+                setrlimit(RLIMIT_FSIZE, &old_limit);    // room again
+            write_window(writer, windows[i], write_errors);
+        }
+        writer.close();
+        setrlimit(RLIMIT_FSIZE, &old_limit);
+
+        const size_t read = read_back(path, windows, seconds, failures);
+        bool increasing = true;
+        for (size_t i = 1; i < seconds.size(); ++i)
+            increasing &= seconds[i] > seconds[i - 1];
+        const size_t expected = windows.size() - writer.dropped_windows();
+        std::printf("%s: %d failed writes, %zu windows dropped, %zu read back\n",
+                    overflow ? "full disk, small buffer" : "full disk", write_errors,
+                    writer.dropped_windows(), read);
+        if (write_errors == 0 || !increasing || read != expected
+            || (overflow ? writer.dropped_windows() == 0 : writer.dropped_windows() != 0)) {
+            std::printf("unexpected result after failed writes\n");
+            failures += 1;
+        }
+    }
+
+    // A corrupt length field is rejected, not allocated.
+    {
+        FILE* f = std::fopen(path.c_str(), "wb");
+        uint8_t h[TC_BINARY_HEADER_LEN + 4] = {'T', 'C', 'W', 'B'};
+        le_put(h + 4, TC_BINARY_VERSION, 2);
+        le_put(h + 6, TC_BINARY_HEADER_LEN, 2);
+        le_put(h + 8, 50, 4);
+        le_put(h + TC_BINARY_HEADER_LEN, 0xfffffff0u, 4);
+        std::fwrite(h, 1, sizeof(h), f);
+        std::fclose(f);
+        BinaryReader reader;
+        BinaryWindow w;
+        if (!reader.open(path) || reader.next(w) || reader.error().empty()) {
+            std::printf("oversized record length accepted\n");
+            failures += 1;
+        }
+    }
+
+    unlink(path.c_str());
+    std::printf("%zu windows: %s\n", windows.size(), failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
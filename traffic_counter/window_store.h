@@ -0,0 +1,184 @@
+/**
+ * Flat per-window store of the collector's cumulative counters.
+ *
+ * One store holds one second (one slot of the global ring buffer): an open-addressing
+ * index from key (IPv4 address, flow ID or IPv6 address) to a dense row, and one
+ * contiguous rows x ticks matrix per metric (structure of arrays). Rows are handed out
+ * in insertion order and `clear()` keeps the capacity, so a store that has seen its
+ * peak number of keys never allocates again. Next to the bins, every tick has the
+ * CLOCK_MONOTONIC time in nanoseconds its values were sampled at, 0 if never sampled.
+ *
+ * Checked-in date: Oct 17, 2026
+ * Author: xmei@jlab.org
+ */
+
+#ifndef WINDOW_STORE_H
+#define WINDOW_STORE_H
+
+#include <linux/types.h>
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+// ++ IPv6 address (network order) as a container key
+using Ip6Addr = std::array<__u8, 16>;
+
+// Fibonacci hashing; the index uses the high bits of the product.
+inline uint64_t window_key_hash(const uint32_t key) {
+    return static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+}
+
+inline uint64_t window_key_hash(const Ip6Addr& key) {
+    uint64_t w[2];
+    std::memcpy(w, key.data(), sizeof(w));
+    return (w[0] ^ (w[1] * 0xC2B2AE3D27D4EB4FULL)) * 0x9E3779B97F4A7C15ULL;
+}
+
+// Metrics of a row, one bin matrix each.
+enum WindowMetric : size_t {
+    TCP_BYTES = 0,
+    TCP_PACKETS,
+    UDP_BYTES,
+    UDP_PACKETS,
+    NUM_WINDOW_METRICS
+};
+
+// JSON field name of every metric, in ascending order (the member order of a json object).
+inline const char* const METRIC_NAMES[NUM_WINDOW_METRICS] = {
+    "tcp_bytes", "tcp_packets", "udp_bytes", "udp_packets"};
+
+/**
+ * @brief Duration in seconds of each of the `n` ticks sampled at `tick_ns`.
+ *
+ * The first tick runs from `prev_tick_ns`, the last tick of the previous window. Ticks
+ * without a sampling time (not polled) or with no previous one get `nominal_s`.
+ */
+inline std::vector<double> tick_durations(const __u64* tick_ns, const size_t n,
+    const __u64 prev_tick_ns, const double nominal_s) {
+    std::vector<double> dt(n, nominal_s);
+    __u64 prev = prev_tick_ns;
+    for (size_t i = 0; i < n; ++i) {
+        if (tick_ns[i] == 0)
+            continue;
+        if (prev != 0 && tick_ns[i] > prev)
+            dt[i] = (tick_ns[i] - prev) * 1e-9;
+        prev = tick_ns[i];
+    }
+    return dt;
+}
+
+// Latest of the `n` sampling times, or `prev_tick_ns` if no tick was sampled.
+inline __u64 last_tick_of(const __u64* tick_ns, const size_t n, const __u64 prev_tick_ns) {
+    for (size_t i = n; i > 0; --i) {
+        if (tick_ns[i - 1] != 0)
+            return tick_ns[i - 1];
+    }
+    return prev_tick_ns;
+}
+
+template <typename Key>
+struct WindowStore {
+    /**
+     * @brief Set the number of ticks per row and drop all rows. Allocates nothing;
+     *        rows are allocated on demand by `find_or_insert()`.
+     */
+    void init(size_t ticks) {
+        ticks_ = ticks;
+        rows_cap_ = 0;
+        num_rows_ = 0;
+        tick_ns_.assign(ticks, 0);
+        keys_.clear();
+        index_.clear();
+        for (auto& m : bins_) m.clear();
+    }
+
+    /**
+     * @brief Row of `key`, inserting a zeroed row if the key is new in this window.
+     *        Allocates only when the row capacity is exhausted (doubling).
+     */
+    size_t find_or_insert(const Key& key) {
+        if (num_rows_ == rows_cap_)
+            grow(rows_cap_ ? rows_cap_ * 2 : INITIAL_ROWS);
+
+        const size_t mask = index_.size() - 1;
+        size_t pos = static_cast<size_t>(window_key_hash(key) >> shift_) & mask;
+        while (index_[pos] != 0) {
+            size_t row = index_[pos] - 1;
+            if (keys_[row] == key)
+                return row;
+            pos = (pos + 1) & mask;
+        }
+        index_[pos] = static_cast<uint32_t>(num_rows_ + 1);
+        keys_[num_rows_] = key;
+        return num_rows_++;
+    }
+
+    // The `ticks()` cumulative values of one metric of a row.
+    __u64* row(size_t r, WindowMetric m) { return bins_[m].data() + r * ticks_; }
+    const __u64* row(size_t r, WindowMetric m) const { return bins_[m].data() + r * ticks_; }
+
+    // Sampling time of every tick (CLOCK_MONOTONIC ns), `ticks()` values.
+    __u64* tick_ns() { return tick_ns_.data(); }
+    const __u64* tick_ns() const { return tick_ns_.data(); }
+
+    const Key& key(size_t r) const { return keys_[r]; }
+    size_t size() const { return num_rows_; }
+    bool empty() const { return num_rows_ == 0; }
+    size_t ticks() const { return ticks_; }
+
+    /**
+     * @brief Drop all rows of the window and zero their bins and tick times; keeps the capacity.
+     */
+    void clear() {
+        std::fill(tick_ns_.begin(), tick_ns_.end(), 0);
+        if (num_rows_ == 0)
+            return;
+        for (auto& m : bins_)
+            std::fill(m.begin(), m.begin() + num_rows_ * ticks_, 0);
+        std::fill(index_.begin(), index_.end(), 0);
+        num_rows_ = 0;
+    }
+
+private:
+    static constexpr size_t INITIAL_ROWS = 64;
+
+    // Resize the matrices (existing rows keep their offsets) and rebuild the index at
+    // a load factor of at most 1/2.
+    void grow(size_t new_cap) {
+        rows_cap_ = new_cap;
+        keys_.resize(rows_cap_);
+        for (auto& m : bins_)
+            m.resize(rows_cap_ * ticks_, 0);
+
+        size_t index_size = 1;
+        unsigned bits = 0;
+        while (index_size < rows_cap_ * 2) {
+            index_size <<= 1;
+            bits += 1;
+        }
+        shift_ = 64 - (bits ? bits : 1);
+        index_.assign(index_size, 0);
+        const size_t mask = index_size - 1;
+        for (size_t r = 0; r < num_rows_; ++r) {
+            size_t pos = static_cast<size_t>(window_key_hash(keys_[r]) >> shift_) & mask;
+            while (index_[pos] != 0)
+                pos = (pos + 1) & mask;
+            index_[pos] = static_cast<uint32_t>(r + 1);
+        }
+    }
+
+    size_t ticks_ = 0;
+    size_t rows_cap_ = 0;
+    size_t num_rows_ = 0;
+    unsigned shift_ = 63;
+    std::vector<__u64> tick_ns_;            // sampling time by tick
+    std::vector<Key> keys_;                 // key by row
+    std::vector<uint32_t> index_;           // row + 1 by hash slot, 0 = empty
+    std::array<std::vector<__u64>, NUM_WINDOW_METRICS> bins_;  // rows_cap_ * ticks_ each
+};
+
+#endif